@@ -0,0 +1,320 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "conway.h"
+#include "record.h"
+
+/*
+ * Batch Program
+ *
+ * Plays a great many rounds headless, spread over every core, and reports how they went. Each
+ * round starts from an empty board with an opening: the cells red and blue placed. Openings are
+ * either generated, each side scattering its cells in a random patch, or read from a file.
+ *
+ * An opening file has one round per line: red's cells, a slash, then blue's cells, each cell
+ * written row,column. Lines starting with # are skipped. For example:
+ *
+ *   10,10 10,11 10,12 / 30,30 31,30 32,30
+ */
+
+#define CHUNK 64 // Rounds a job takes at a time
+
+// One round's opening
+typedef struct opening {
+  placements_t red;
+  placements_t blue;
+} opening_t;
+
+// How a batch of rounds went
+typedef struct tally {
+  long rounds;
+  long red_wins;
+  long blue_wins;
+  long ties;
+  long red_cells;   // Summed over every round
+  long blue_cells;
+  long generations;
+} tally_t;
+
+// The batch, shared by the jobs playing it
+static struct {
+  pthread_mutex_t lock;
+  int width;
+  int height;
+  long rounds;
+  long next;
+  opening_t * openings; // NULL if openings are generated
+  int red_count;
+  int blue_count;
+  int patch;
+  uint64_t seed;
+  bool verbose;
+  tally_t tally;
+} batch = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Scatter count cells of a color in a random patch of the board, none on the same cell
+static void random_cells(board_t board, placements_t * placements, int count, int color,
+                         uint64_t * rng) {
+  int size = batch.patch;
+  if (size > board->height) size = board->height;
+  if (size > board->width) size = board->width;
+  int row = random_below(rng, board->height - size + 1);
+  int column = random_below(rng, board->width - size + 1);
+
+  placements->count = 0;
+  while (placements->count < count) {
+    int r = row + random_below(rng, size);
+    int c = column + random_below(rng, size);
+    bool taken = false;
+    for (int i = 0; i < placements->count && !taken; i++) {
+      taken = placements->cells[i].row == r && placements->cells[i].column == c;
+    }
+    if (!taken) record_placement(placements, r, c, color);
+  }
+}
+
+// Read one side of an opening. Returns false if a cell is malformed or off the board.
+static bool parse_cells(char * text, placements_t * placements, int color) {
+  for (char * word = strtok(text, " \t\n"); word != NULL; word = strtok(NULL, " \t\n")) {
+    int row;
+    int column;
+    int n;
+    if (sscanf(word, "%d,%d%n", &row, &column, &n) != 2 || word[n] != '\0' || row < 0 ||
+        row >= batch.height || column < 0 || column >= batch.width) {
+      return false;
+    }
+    record_placement(placements, row, column, color);
+  }
+  return true;
+}
+
+// Read every opening in a file. Returns the number read, or -1 if the file can't be read or a
+// line is malformed.
+static long read_openings(const char * path) {
+  FILE * file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  long count = 0;
+  long capacity = 0;
+  long line_number = 0;
+  char * line = NULL;
+  size_t line_capacity = 0;
+  while (getline(&line, &line_capacity, file) > 0) {
+    line_number++;
+    if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0') continue;
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      opening_t * bigger = (opening_t *) realloc(batch.openings, sizeof(opening_t) * capacity);
+      if (bigger == NULL) exit(EXIT_FAILURE);
+      batch.openings = bigger;
+    }
+    opening_t * opening = &batch.openings[count++];
+    memset(opening, 0, sizeof(opening_t));
+
+    char * slash = strchr(line, '/');
+    if (slash != NULL) *slash = '\0';
+    if (slash == NULL || !parse_cells(line, &opening->red, RED) ||
+        !parse_cells(slash + 1, &opening->blue, BLUE)) {
+      fprintf(stderr, "%s:%ld: not an opening\n", path, line_number);
+      count = -1;
+      break;
+    }
+  }
+
+  free(line);
+  fclose(file);
+  return count;
+}
+
+// A job playing rounds until there are none left
+static void * play_rounds(void * arg) {
+  board_t board = create_board(batch.width, batch.height);
+  if (board == NULL) exit(EXIT_FAILURE);
+  opening_t generated = {0};
+  tally_t tally = {0};
+
+  while (true) {
+    pthread_mutex_lock(&batch.lock);
+    long first = batch.next;
+    batch.next += CHUNK;
+    pthread_mutex_unlock(&batch.lock);
+    if (first >= batch.rounds) break;
+    long last = first + CHUNK < batch.rounds ? first + CHUNK : batch.rounds;
+
+    for (long i = first; i < last; i++) {
+      opening_t * opening = &generated;
+      if (batch.openings != NULL) {
+        opening = &batch.openings[i];
+      } else {
+        // Seeded per round, so the openings don't depend on which job plays them
+        uint64_t rng = (batch.seed + i) * 0x9e3779b97f4a7c15ULL | 1;
+        random_cells(board, &generated.red, batch.red_count, RED, &rng);
+        random_cells(board, &generated.blue, batch.blue_count, BLUE, &rng);
+      }
+
+      clear_board(board);
+      apply_placements(board, &opening->red, &opening->blue);
+      round_t round;
+      start_round(&round, board);
+      while (step_round(&round, board)) {}
+
+      score_t score = count_board(board);
+      tally.rounds++;
+      if (score.diff > 0) tally.red_wins++;
+      else if (score.diff < 0) tally.blue_wins++;
+      else tally.ties++;
+      tally.red_cells += score.red;
+      tally.blue_cells += score.blue;
+      tally.generations += round.step;
+
+      if (batch.verbose) {
+        // Lines may come out of order, so each says which round it is
+        flockfile(stdout);
+        printf("%ld,%d,%d,%d\n", i, score.red, score.blue, round.step);
+        funlockfile(stdout);
+      }
+    }
+  }
+
+  pthread_mutex_lock(&batch.lock);
+  batch.tally.rounds += tally.rounds;
+  batch.tally.red_wins += tally.red_wins;
+  batch.tally.blue_wins += tally.blue_wins;
+  batch.tally.ties += tally.ties;
+  batch.tally.red_cells += tally.red_cells;
+  batch.tally.blue_cells += tally.blue_cells;
+  batch.tally.generations += tally.generations;
+  pthread_mutex_unlock(&batch.lock);
+
+  free(generated.red.cells);
+  free(generated.blue.cells);
+  free_board(board);
+  return NULL;
+}
+
+int main(int argc, char ** argv) {
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  const char * path = NULL;
+  batch.width = BOARD_SIZE;
+  batch.height = BOARD_SIZE;
+  batch.rounds = 100000;
+  batch.red_count = 10;
+  batch.blue_count = 10;
+  batch.seed = 1;
+
+  // Read command line options
+  int opt;
+  bool valid = true;
+  while ((opt = getopt(argc, argv, "w:h:n:c:p:f:j:S:v")) != -1) {
+    switch (opt) {
+    case 'w':
+      batch.width = atoi(optarg);
+      break;
+    case 'h':
+      batch.height = atoi(optarg);
+      break;
+    case 'n':
+      // Rounds to play with generated openings
+      batch.rounds = atol(optarg);
+      break;
+    case 'c':
+      // Cells each side places, like 10 or, to give blue a loss bonus, 10,25
+      switch (sscanf(optarg, "%d,%d", &batch.red_count, &batch.blue_count)) {
+      case 1:
+        batch.blue_count = batch.red_count;
+        break;
+      case 2:
+        break;
+      default:
+        valid = false;
+      }
+      break;
+    case 'p':
+      // Width and height of the patch each side's cells are scattered in
+      batch.patch = atoi(optarg);
+      break;
+    case 'f':
+      // Play the openings in a file instead of generating them
+      path = optarg;
+      break;
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    case 'S':
+      batch.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'v':
+      // Print a line of CSV for every round
+      batch.verbose = true;
+      break;
+    default:
+      valid = false;
+    }
+  }
+
+  // Unless asked, make the patch about twice as big as the cells in it
+  int most = batch.red_count > batch.blue_count ? batch.red_count : batch.blue_count;
+  if (batch.patch == 0) {
+    while (batch.patch * batch.patch < 2 * most) batch.patch++;
+  }
+
+  if (!valid || optind != argc || !valid_dimensions(batch.width, batch.height) ||
+      batch.rounds < 1 || batch.red_count < 0 || batch.blue_count < 0 || jobs < 1 ||
+      (long)batch.patch * batch.patch < most || batch.patch > batch.width ||
+      batch.patch > batch.height) {
+    fprintf(stderr, "Usage: %s [-w width] [-h height] [-n rounds] [-c cells[,blue cells]] "
+            "[-p patch]\n"
+            "       [-f openings] [-j jobs] [-S seed] [-v]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (path != NULL) {
+    batch.rounds = read_openings(path);
+    if (batch.rounds < 0) exit(EXIT_FAILURE);
+  }
+
+  if (batch.verbose) printf("round,red,blue,generations\n");
+
+  // Each job has its own board, so the boards are updated one thread each
+  set_update_threads(1);
+  pthread_t * threads = (pthread_t *) malloc(sizeof(pthread_t) * jobs);
+  if (threads == NULL) exit(EXIT_FAILURE);
+  double start = now();
+  for (int i = 0; i < jobs; i++) {
+    if (pthread_create(&threads[i], NULL, play_rounds, NULL)) exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+  double seconds = now() - start;
+
+  tally_t * t = &batch.tally;
+  double rounds = t->rounds ? t->rounds : 1;
+  fprintf(stderr, "%ld rounds in %.3fs, %.0f rounds a second\n", t->rounds, seconds,
+          t->rounds / seconds);
+  fprintf(stderr, "red wins %ld (%.2f%%), blue wins %ld (%.2f%%), ties %ld (%.2f%%)\n",
+          t->red_wins, 100 * t->red_wins / rounds, t->blue_wins, 100 * t->blue_wins / rounds,
+          t->ties, 100 * t->ties / rounds);
+  fprintf(stderr, "mean final cells red %.2f, blue %.2f, mean generations %.2f\n",
+          t->red_cells / rounds, t->blue_cells / rounds, t->generations / rounds);
+
+  for (long i = 0; batch.openings != NULL && i < batch.rounds; i++) {
+    free(batch.openings[i].red.cells);
+    free(batch.openings[i].blue.cells);
+  }
+  free(batch.openings);
+  free(threads);
+  return 0;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "conway.h"
+#include "hashlife.h"
+#include "sparse.h"
+
+/*
+ * Benchmark Program
+ *
+ * Runs the simulation engines headless over every combination of board size, density and
+ * generation count asked for, and prints a line of CSV for each. Times are the median and best
+ * of the repetitions, after the warm-up runs. A run an engine gives up on, as Hashlife does when
+ * it runs out of nodes, has its timing fields left empty. Hashlife and the sparse engine are timed
+ * from loading the board to writing the result back onto it.
+ */
+
+#define MAX_LIST 16 // Most values a list option can hold
+
+// A run of the benchmark: one engine advancing a freshly filled board some generations
+typedef struct run {
+  const char * engine;
+  int size;
+  double density;
+  long generations;
+} run_t;
+
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Time one run. Returns a negative number if the engine gave up.
+static double time_run(run_t * run, board_t board) {
+  double start = now();
+  if (strcmp(run->engine, "hashlife") == 0) {
+    // A new engine every time, so nothing is remembered from the last repetition
+    hashlife_t * life = hashlife_create();
+    if (life == NULL) return -1;
+    int rc = hashlife_run(life, board, run->generations);
+    hashlife_free(life);
+    if (rc) return -1;
+  } else if (strcmp(run->engine, "sparse") == 0) {
+    sparse_t * sparse = sparse_create(board->width, board->height);
+    if (sparse == NULL) return -1;
+    int rc = sparse_load(sparse, board) || sparse_run(sparse, run->generations);
+    if (rc == 0) sparse_store(sparse, board);
+    sparse_free(sparse);
+    if (rc) return -1;
+  } else {
+    for (long i = 0; i < run->generations; i++) update_board(board);
+  }
+  return now() - start;
+}
+
+static int compare_doubles(const void * a, const void * b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Read a comma separated list of numbers. Returns how many there were, or -1 if the list is bad.
+static int parse_list(const char * text, double * values) {
+  int count = 0;
+  while (*text) {
+    char * end;
+    double value = strtod(text, &end);
+    if (end == text || value <= 0 || count == MAX_LIST) return -1;
+    values[count++] = value;
+    if (*end == ',') end++;
+    else if (*end != '\0') return -1;
+    text = end;
+  }
+  return count;
+}
+
+int main(int argc, char ** argv) {
+  double sizes[MAX_LIST] = {64, 256, 1024};
+  double densities[MAX_LIST] = {0.05, 0.25, 0.5};
+  double generations[MAX_LIST] = {75, 300};
+  int nsizes = 3;
+  int ndensities = 3;
+  int ngenerations = 2;
+  // The sparse engine is slow on dense boards, so it only runs when asked for
+  const char * const engines[] = {"update", "hashlife", "sparse"};
+  int first_engine = 0;
+  int nengines = 2;
+  int warmups = 1;
+  int repetitions = 3;
+  int threads = 1;
+  uint64_t seed = 1;
+
+  // Read command line options
+  int opt;
+  bool valid = true;
+  while ((opt = getopt(argc, argv, "s:d:g:e:w:r:t:S:")) != -1) {
+    switch (opt) {
+    case 's':
+      nsizes = parse_list(optarg, sizes);
+      break;
+    case 'd':
+      ndensities = parse_list(optarg, densities);
+      break;
+    case 'g':
+      ngenerations = parse_list(optarg, generations);
+      break;
+    case 'e':
+      // One engine on its own, or all of them
+      if (strcmp(optarg, "all") == 0) {
+        first_engine = 0;
+        nengines = 3;
+      } else {
+        bool found = false;
+        for (int i = 0; i < 3 && !found; i++) {
+          if (strcmp(optarg, engines[i]) == 0) {
+            first_engine = i;
+            found = true;
+          }
+        }
+        nengines = 1;
+        if (!found) valid = false;
+      }
+      break;
+    case 'w':
+      warmups = atoi(optarg);
+      break;
+    case 'r':
+      repetitions = atoi(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'S':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      valid = false;
+    }
+  }
+
+  for (int i = 0; i < nsizes; i++) {
+    if (!valid_dimensions((int)sizes[i], (int)sizes[i])) valid = false;
+  }
+  for (int i = 0; i < ndensities; i++) {
+    if (densities[i] > 1) valid = false;
+  }
+  if (!valid || nsizes < 1 || ndensities < 1 || ngenerations < 1 || warmups < 0 ||
+      repetitions < 1 || threads < 1) {
+    fprintf(stderr, "Usage: %s [-s sizes] [-d densities] [-g generations] "
+            "[-e update|hashlife|sparse|all]\n"
+            "       [-w warmups] [-r repetitions] [-t threads] [-S seed]\n", argv[0]);
+    fprintf(stderr, "Lists are comma separated, like -s 64,256,1024 -d 0.05,0.5\n");
+    exit(EXIT_FAILURE);
+  }
+
+  threads = set_update_threads(threads);
+  double * times = (double *) malloc(sizeof(double) * repetitions);
+  if (times == NULL) exit(EXIT_FAILURE);
+
+  printf("engine,size,density,generations,threads,repetitions,"
+         "median_seconds,best_seconds,generations_per_second,cells_per_second\n");
+
+  for (int e = 0; e < nengines; e++) {
+    for (int s = 0; s < nsizes; s++) {
+      board_t board = create_board((int)sizes[s], (int)sizes[s]);
+      if (board == NULL) exit(EXIT_FAILURE);
+
+      for (int d = 0; d < ndensities; d++) {
+        for (int g = 0; g < ngenerations; g++) {
+          run_t run = {engines[first_engine + e], (int)sizes[s], densities[d],
+                       (long)generations[g]};
+
+          // Every repetition starts from the same board, and only the simulation is timed
+          bool failed = false;
+          for (int i = 0; i < warmups + repetitions && !failed; i++) {
+            fill_board(board, run.density, seed);
+            double seconds = time_run(&run, board);
+            if (seconds < 0) failed = true;
+            if (i >= warmups) times[i - warmups] = seconds;
+          }
+
+          if (failed) {
+            printf("%s,%d,%g,%ld,%d,%d,,,,\n", run.engine, run.size, run.density,
+                   run.generations, threads, repetitions);
+          } else {
+            qsort(times, repetitions, sizeof(double), compare_doubles);
+            double median = times[repetitions / 2];
+            double cells = (double)run.size * run.size * run.generations;
+            printf("%s,%d,%g,%ld,%d,%d,%.6f,%.6f,%.1f,%.1f\n", run.engine, run.size,
+                   run.density, run.generations, threads, repetitions, median, times[0],
+                   run.generations / median, cells / median);
+          }
+          fflush(stdout);
+        }
+      }
+
+      free_board(board);
+    }
+  }
+
+  free(times);
+  return 0;
+}
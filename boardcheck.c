@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "conway.h"
+#include "hashlife.h"
+#include "sparse.h"
+
+/*
+ * Board Check Program
+ *
+ * Checks that update_board follows rule_entry cell by cell, that the Hashlife and sparse engines
+ * reach exactly the boards update_board does, that a board copied onto another, which has
+ * already been played on, plays out exactly as the original does, and that the hashes
+ * board_fingerprint reads are kept up to date as a board plays out. Exits with a failure if any
+ * check fails.
+ */
+
+#define CHECK_GENERATIONS 20 // Generations each pair of boards is played for
+
+// Whether two boards hold the same cells
+static bool same_board(board_t a, board_t b) {
+  size_t plane = (size_t)a->height * a->words * sizeof(uint64_t);
+  return a->hash == b->hash && a->locked_hash == b->locked_hash && memcmp(a->red, b->red, plane) == 0 &&
+         memcmp(a->blue, b->blue, plane) == 0 && memcmp(a->locked, b->locked, plane) == 0;
+}
+
+// Copy a board onto one that has a game of its own behind it, then play both. Returns false if
+// they ever differ.
+static bool check_copy(int width, int height, double density, uint64_t seed) {
+  board_t original = create_board(width, height);
+  board_t copy = create_board(width, height);
+  if (original == NULL || copy == NULL) exit(EXIT_FAILURE);
+
+  // Leave the copy's scratch planes and tile flags full of another game
+  fill_board(copy, 0.5, seed + 1);
+  for (int i = 0; i < 3; i++) update_board(copy);
+
+  // Let the original settle a little, so some of its tiles have gone to sleep
+  fill_board(original, density, seed);
+  for (int i = 0; i < 3; i++) update_board(original);
+
+  copy_board(copy, original);
+  bool same = same_board(copy, original);
+  for (int i = 0; i < CHECK_GENERATIONS && same; i++) {
+    update_board(original);
+    update_board(copy);
+    same = same_board(copy, original);
+  }
+
+  if (!same) {
+    score_t a = count_board(original);
+    score_t b = count_board(copy);
+    printf("%dx%d at %g, seed %llu: copy has red %d blue %d, original red %d blue %d\n", width,
+           height, density, (unsigned long long)seed, b.red, b.blue, a.red, a.blue);
+  }
+  free_board(original);
+  free_board(copy);
+  return same;
+}
+
+// Play a board, recomputing its hashes from its cells after every generation. Returns false if
+// the ones update_board kept ever differ.
+static bool check_hashes(int width, int height, double density, uint64_t seed) {
+  board_t board = create_board(width, height);
+  if (board == NULL) exit(EXIT_FAILURE);
+  fill_board(board, density, seed);
+
+  bool same = true;
+  for (int i = 0; i <= CHECK_GENERATIONS && same; i++) {
+    if (i > 0) update_board(board);
+    uint64_t hash = 0;
+    uint64_t locked_hash = 0;
+    for (int row = 0; row < height; row++) {
+      for (int column = 0; column < width; column++) {
+        cell_t cell = get_cell(board, row, column);
+        if (cell.alive) hash ^= cell_key(row, column, cell.color);
+        if (cell.locked) locked_hash ^= lock_key(row, column);
+      }
+    }
+    same = hash == board->hash && locked_hash == board->locked_hash;
+    if (!same) {
+      printf("%dx%d at %g, seed %llu: hashes wrong after %d generations\n", width, height,
+             density, (unsigned long long)seed, i);
+    }
+  }
+
+  free_board(board);
+  return same;
+}
+
+// The state rule entries act on, of a cell, or of no cell at all outside the board
+static int cell_state(board_t board, int row, int column) {
+  cell_t cell = get_cell(board, row, column);
+  return cell.color | (cell.locked ? RULE_LOCKED : 0);
+}
+
+// Play a board, working out each generation a cell at a time from rule_entry as well. Returns
+// false if update_board ever disagrees.
+static bool check_rules(int width, int height, double density, uint64_t seed) {
+  board_t board = create_board(width, height);
+  // Each cell's state, inside a border of dead cells, so every cell has eight neighbors
+  int stride = width + 2;
+  uint8_t * states = calloc((size_t)stride * (height + 2), 1);
+  uint8_t * expected = malloc((size_t)width * height);
+  if (board == NULL || states == NULL || expected == NULL) exit(EXIT_FAILURE);
+  fill_board(board, density, seed);
+
+  bool same = true;
+  for (int i = 1; i <= CHECK_GENERATIONS && same; i++) {
+    for (int row = 0; row < height; row++) {
+      for (int column = 0; column < width; column++) {
+        states[(size_t)(row + 1) * stride + column + 1] = cell_state(board, row, column);
+      }
+    }
+    for (int row = 0; row < height; row++) {
+      for (int column = 0; column < width; column++) {
+        const uint8_t * center = &states[(size_t)(row + 1) * stride + column + 1];
+        int neighbors = 0;
+        int reds = 0;
+        for (int dr = -1; dr <= 1; dr++) {
+          for (int dc = -1; dc <= 1; dc++) {
+            int color = center[dr * stride + dc] & 3;
+            if ((dr == 0 && dc == 0) || color == COLORLESS) continue;
+            neighbors++;
+            if (color == RED) reds++;
+          }
+        }
+        uint8_t entry = rule_entry((*center & 3) != COLORLESS, neighbors, reds);
+        expected[(size_t)row * width + column] = (*center & (entry >> 4)) | (entry & 0x0f);
+      }
+    }
+
+    update_board(board);
+    for (int row = 0; row < height && same; row++) {
+      for (int column = 0; column < width && same; column++) {
+        int state = cell_state(board, row, column);
+        same = state == expected[(size_t)row * width + column];
+        if (!same) {
+          printf("%dx%d at %g, seed %llu: cell %d,%d is %d after %d generations, not %d\n", width,
+                 height, density, (unsigned long long)seed, row, column, state, i,
+                 expected[(size_t)row * width + column]);
+        }
+      }
+    }
+  }
+
+  free(states);
+  free(expected);
+  free_board(board);
+  return same;
+}
+
+// Play a board with update_board, and the same board with the Hashlife and sparse engines.
+// Returns false if either ends up anywhere else. The Hashlife engine is shared between checks, so
+// what it remembers from other boards is put to use.
+static bool check_engines(hashlife_t * life, int width, int height, double density,
+                          uint64_t seed) {
+  board_t board = create_board(width, height);
+  board_t hashed = create_board(width, height);
+  board_t stored = create_board(width, height);
+  sparse_t * sparse = sparse_create(width, height);
+  if (board == NULL || hashed == NULL || stored == NULL || sparse == NULL) exit(EXIT_FAILURE);
+
+  fill_board(board, density, seed);
+  copy_board(hashed, board);
+  if (sparse_load(sparse, board)) exit(EXIT_FAILURE);
+  for (int i = 0; i < CHECK_GENERATIONS; i++) update_board(board);
+
+  bool same = true;
+  if (hashlife_run(life, hashed, CHECK_GENERATIONS)) exit(EXIT_FAILURE);
+  if (!same_board(hashed, board)) {
+    printf("%dx%d at %g, seed %llu: Hashlife differs from update_board\n", width, height,
+           density, (unsigned long long)seed);
+    same = false;
+  }
+  if (sparse_run(sparse, CHECK_GENERATIONS)) exit(EXIT_FAILURE);
+  sparse_store(sparse, stored);
+  if (sparse_hash(sparse) != board->hash || !same_board(stored, board)) {
+    printf("%dx%d at %g, seed %llu: sparse engine differs from update_board\n", width, height,
+           density, (unsigned long long)seed);
+    same = false;
+  }
+
+  sparse_free(sparse);
+  free_board(board);
+  free_board(hashed);
+  free_board(stored);
+  return same;
+}
+
+int main() {
+  const int sizes[][2] = {{50, 50}, {30, 20}, {64, 64}, {130, 70}, {256, 256}};
+  const double densities[] = {0.001, 0.05, 0.3};
+  int failures = 0;
+  int checks = 0;
+  hashlife_t * life = hashlife_create();
+  if (life == NULL) exit(EXIT_FAILURE);
+
+  // Serially, then split across threads
+  for (int threads = 1; threads <= 4; threads += 3) {
+    set_update_threads(threads);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++) {
+        for (uint64_t seed = 1; seed <= 4; seed++) {
+          checks++;
+          if (!check_rules(sizes[s][0], sizes[s][1], densities[d], seed)) failures++;
+          checks++;
+          if (!check_engines(life, sizes[s][0], sizes[s][1], densities[d], seed)) failures++;
+          checks++;
+          if (!check_copy(sizes[s][0], sizes[s][1], densities[d], seed)) failures++;
+          checks++;
+          if (!check_hashes(sizes[s][0], sizes[s][1], densities[d], seed)) failures++;
+        }
+      }
+    }
+  }
+  set_update_threads(1);
+  hashlife_free(life);
+
+  printf("%d of %d checks passed\n", checks - failures, checks);
+  return failures ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bot.h"
+
+// Rounds without an improvement before the search gives up on a cluster and tries another
+#define RESTART_AFTER 60
+
+// The cells the bot is thinking of placing
+typedef struct candidate {
+  int * rows;
+  int * columns;
+  int count;
+  int score;
+} candidate_t;
+
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read a budget from the command line
+bool bot_parse_budget(const char * text, bot_budget_t * budget) {
+  char * end;
+  double value = strtod(text, &end);
+  if (end == text || value <= 0) return false;
+
+  budget->simulations = 0;
+  budget->seconds = 0;
+  if (strcmp(end, "s") == 0) {
+    budget->seconds = value;
+  } else if (strcmp(end, "ms") == 0) {
+    budget->seconds = value / 1000;
+  } else if (*end == '\0' && value == (int)value) {
+    budget->simulations = (int)value;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Whether a cell is free to place on, and not already in the candidate
+static bool open_cell(board_t board, candidate_t * c, int row, int column, int skip) {
+  if (outofbounds(board, row, column) || get_cell(board, row, column).alive) return false;
+  for (int i = 0; i < c->count; i++) {
+    if (i != skip && c->rows[i] == row && c->columns[i] == column) return false;
+  }
+  return true;
+}
+
+// Scatter the candidate's cells close together around a random open cell. Cells near each other
+// can hold each other up; lone cells just die.
+static void random_cluster(board_t board, candidate_t * c, int count, uint64_t * rng) {
+  int row = random_below(rng, board->height);
+  int column = random_below(rng, board->width);
+  int radius = 1;
+  while ((2 * radius + 1) * (2 * radius + 1) < count * 2) radius++;
+
+  c->count = 0;
+  for (int tries = 0; c->count < count && tries < count * 100; tries++) {
+    // Widen the cluster if it has filled up
+    if (tries % (count * 10) == count * 10 - 1) radius++;
+    int r = row + random_below(rng, 2 * radius + 1) - radius;
+    int col = column + random_below(rng, 2 * radius + 1) - radius;
+    if (open_cell(board, c, r, col, -1)) {
+      c->rows[c->count] = r;
+      c->columns[c->count] = col;
+      c->count++;
+    }
+  }
+}
+
+// Move one of the candidate's cells next to another one of them
+static void mutate(board_t board, candidate_t * c, uint64_t * rng) {
+  if (c->count == 0) return;
+  int moved = random_below(rng, c->count);
+  for (int tries = 0; tries < 20; tries++) {
+    int anchor = random_below(rng, c->count);
+    int r = c->rows[anchor] + random_below(rng, 5) - 2;
+    int col = c->columns[anchor] + random_below(rng, 5) - 2;
+    if (open_cell(board, c, r, col, moved)) {
+      c->rows[moved] = r;
+      c->columns[moved] = col;
+      return;
+    }
+  }
+}
+
+// Play out a round with the candidate's cells placed, and score it for the bot's color
+static int evaluate(board_t board, board_t scratch, candidate_t * c, int color) {
+  copy_board(scratch, board);
+  for (int i = 0; i < c->count; i++) {
+    set_cell(scratch, c->rows[i], c->columns[i], color, false);
+  }
+
+  round_t round;
+  start_round(&round, scratch);
+  while (step_round(&round, scratch)) {}
+
+  score_t score = count_board(scratch);
+  return color == RED ? score.diff : -score.diff;
+}
+
+static void copy_candidate(candidate_t * dest, candidate_t * source) {
+  memcpy(dest->rows, source->rows, sizeof(int) * source->count);
+  memcpy(dest->columns, source->columns, sizeof(int) * source->count);
+  dest->count = source->count;
+  dest->score = source->score;
+}
+
+// Choose and place the bot's cells
+int bot_set_board(int count, int color, board_t board, placements_t * placements,
+                  bot_budget_t budget, conn_t * conn) {
+  placements->count = 0;
+  if (count <= 0) return 0;
+  if (budget.simulations <= 0 && budget.seconds <= 0) {
+    budget.simulations = BOT_DEFAULT_SIMULATIONS;
+  }
+
+  board_t scratch = acquire_board(board->width, board->height);
+  candidate_t best = {0}, current = {0}, trial = {0};
+  candidate_t * all[] = {&best, &current, &trial};
+  for (int i = 0; i < 3; i++) {
+    all[i]->rows = (int *) malloc(sizeof(int) * count);
+    all[i]->columns = (int *) malloc(sizeof(int) * count);
+    if (all[i]->rows == NULL || all[i]->columns == NULL) exit(-1);
+  }
+  if (scratch == NULL) exit(-1);
+
+  // Our own generator, so the search doesn't disturb rand()
+  uint64_t rng = (uint64_t)time(NULL) ^ board->hash ^ ((uint64_t)color << 32);
+  rng = rng * 0x2545f4914f6cdd1dULL + 1;
+  double deadline = now() + budget.seconds;
+
+  // Climb from random clusters, starting over whenever one stops getting better
+  int simulations = 0;
+  int stale = RESTART_AFTER;
+  best.score = -(board->width * board->height + 1);
+  while ((budget.simulations <= 0 || simulations < budget.simulations) &&
+         (budget.seconds <= 0 || now() < deadline)) {
+    if (stale >= RESTART_AFTER) {
+      random_cluster(board, &trial, count, &rng);
+      stale = 0;
+      current.score = best.score - 1;
+      current.count = 0;
+    } else {
+      copy_candidate(&trial, &current);
+      mutate(board, &trial, &rng);
+    }
+
+    trial.score = evaluate(board, scratch, &trial, color);
+    simulations++;
+    if (conn != NULL) conn_heartbeat(conn);
+
+    // Sideways moves are allowed, so the search can drift across flat ground
+    if (current.count == 0 || trial.score >= current.score) {
+      if (trial.score > current.score) stale = 0;
+      copy_candidate(&current, &trial);
+    }
+    stale++;
+    if (current.score > best.score) copy_candidate(&best, &current);
+  }
+
+  // Place the best cells we found
+  for (int i = 0; i < best.count; i++) {
+    set_cell(board, best.rows[i], best.columns[i], color, false);
+    record_placement(placements, best.rows[i], best.columns[i], color);
+  }
+
+  for (int i = 0; i < 3; i++) {
+    free(all[i]->rows);
+    free(all[i]->columns);
+  }
+  release_board(scratch);
+  return simulations;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "conway.h"
+
+// How long the bot may think about a move: at most this many simulated rounds, and at most this
+// many seconds. Zero means no limit of that kind.
+typedef struct bot_budget {
+  int simulations;
+  double seconds;
+} bot_budget_t;
+
+#define BOT_DEFAULT_SIMULATIONS 500
+
+// Read a budget from the command line: a number of simulations like "500", or a time like "2s"
+// or "250ms". Returns false if the text is neither.
+bool bot_parse_budget(const char * text, bot_budget_t * budget);
+
+// Place up to count cells of a color on the board, the way set_board lets a player, recording
+// them in placements. Candidate placements are played out for a whole round and the one that
+// leaves the color furthest ahead is kept. Heartbeats go out on conn, unless it is NULL, while
+// the bot thinks. Returns the number of rounds simulated.
+int bot_set_board(int count, int color, board_t board, placements_t * placements,
+                  bot_budget_t budget, conn_t * conn);
@@ -1,31 +1,119 @@
 #include <ncurses.h>
 #include <stdlib.h>
 #include <string.h>
+#include "bot.h"
 #include "conway.h"
 #include "socket.h"
+#include "stats.h"
+#include "ui.h"
 
 /*
  * Client Program
  */
+
+// Get the server's next instruction, timing how long we waited on it
+static char * wait_on(conn_t * server) {
+  double begin = stats_begin();
+  char * message = conn_receive_message(server);
+  stats_end(PHASE_WAIT, begin);
+  return message;
+}
  
 int main(int argc, char ** argv) {
+  // With a budget, a bot places our cells instead of the player
+  bool bot = false;
+  bot_budget_t budget;
+
+  // Where to write timings, if anywhere
+  char * stats_path = NULL;
+
+  // Seconds of silence from the server before we give up on it
+  double timeout = PEER_TIMEOUT;
+
+  // A server on this machine may be listening on a Unix-domain socket instead of a TCP port
+  char * local_path = NULL;
+
+  // Read command line options
+  int opt;
+  while ((opt = getopt(argc, argv, "t:b:s:T:u:")) != -1) {
+    switch (opt) {
+    case 't':
+      // Threads used to update the board
+      set_update_threads(atoi(optarg));
+      break;
+    case 'b':
+      // Simulations, or a time like 2s, the bot may spend on each move
+      bot = true;
+      if (!bot_parse_budget(optarg, &budget)) argc = 0;
+      break;
+    case 's':
+      stats_path = optarg;
+      break;
+    case 'T':
+      // Zero waits forever
+      timeout = atof(optarg);
+      if (timeout < 0) argc = 0;
+      break;
+    case 'u':
+      local_path = optarg;
+      break;
+    default:
+      argc = 0;
+    }
+  }
+
   // Check for proper arguments
-  if (argc != 3) {
-    fprintf(stderr, "Usage: %s <server name> <port>\n", argv[0]);
+  if (argc - optind != (local_path ? 0 : 2)) {
+    fprintf(stderr, "Usage: %s [-t threads] [-b budget] [-s stats] [-T timeout] <server name> "
+            "<port>\n", argv[0]);
+    fprintf(stderr, "       %s [-t threads] [-b budget] [-s stats] [-T timeout] -u <socket path>\n",
+            argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  // Read command line arguments
-  char* server_name = argv[1];
-  unsigned short port = atoi(argv[2]);
+  if (stats_path != NULL && stats_open(stats_path)) {
+    perror("Couldn't start collecting stats");
+    exit(EXIT_FAILURE);
+  }
 
   // Connect to the server
-  int socket = socket_connect(server_name, port);
+  int socket;
+  if (local_path) {
+    socket = local_socket_connect(local_path);
+  } else {
+    char* server_name = argv[optind];
+    unsigned short port = atoi(argv[optind + 1]);
+    socket = socket_connect(server_name, port);
+  }
   if (socket == -1) {
     perror("Failed to connect");
     exit(EXIT_FAILURE);
   }
 
+  // Messages to the server are buffered, and go out when we next wait on it or flush. Whenever
+  // we wait, on the server or the player, heartbeats go out and the server's are checked for.
+  conn_options_t options = CONN_DEFAULTS;
+  options.heartbeat = HEARTBEAT_INTERVAL;
+  options.timeout = timeout;
+  // A local server decides whether we go on over the socket or through shared memory
+  conn_t * server = local_path ? conn_join_local(socket, &options) : conn_open(socket, &options);
+  if (server == NULL) {
+    perror("Failed to connect");
+    exit(EXIT_FAILURE);
+  }
+  stats_connection(server,"server");
+
+  // Find out how big the board is, and which color we play. The opponent plays the other one.
+  int width;
+  int height;
+  int color;
+  if (recv_dimensions(server, &width, &height, &color)) {
+    printf("Server did not agree on a board size.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int opponent = color == RED ? BLUE : RED;
+
   // Start with 0 bonus cells
   int bonus = 0;
 
@@ -39,13 +127,16 @@ int main(int argc, char ** argv) {
   refresh();
 
   // Set up windows for board and status line
-  WINDOW * w_board = newwin(BOARD_SIZE,BOARD_SIZE,2,1);
-  WINDOW * w_status = newwin(1,BOARD_SIZE,0,0);
+  // Only as much of the board as fits in the terminal is shown
+  int view_width = width < COLS - 2 ? width : COLS - 2;
+  int view_height = height < LINES - 3 ? height : LINES - 3;
+  WINDOW * w_board = newwin(view_height,view_width,2,1);
+  WINDOW * w_status = newwin(1,COLS,0,0);
 
-  for (int x=0;x<=BOARD_SIZE+1;x++) {
-    for (int y=1;y<=BOARD_SIZE+2;y++) {
-      if ((x==0 || x==BOARD_SIZE+1) ||
-      	  (y==1 || y==BOARD_SIZE+2)) {
+  for (int x=0;x<=view_width+1;x++) {
+    for (int y=1;y<=view_height+2;y++) {
+      if ((x==0 || x==view_width+1) ||
+      	  (y==1 || y==view_height+2)) {
 	      mvaddch(y,x,'*');
       }
     }
@@ -55,13 +146,17 @@ int main(int argc, char ** argv) {
   move(2,1);
 
   // Create empty board to draw to the board window
-  board_t board = create_board();
+  board_t board = create_board(width, height);
 
   // String to store the instructions given by the server
   char * matchinst;
 
+  // The cells each of us placed this round
+  placements_t ours = {0};
+  placements_t theirs = {0};
+
   // Get instructions from server to either start a match, or end winning or losing
-  while ((matchinst = receive_message(socket))) {
+  while ((matchinst = wait_on(server))) {
     if (matchinst == NULL) {
       // Server lost
       endwin();
@@ -69,47 +164,80 @@ int main(int argc, char ** argv) {
       return -1;
     }
 
-    if (strcmp(matchinst,"cwin") == 0) {
-      // Client won
-      endwin();
-      printf("You won the set!\n");
-      return 0;
-    } else if (strcmp(matchinst,"swin") == 0) {
-      // Server won
+    if (strcmp(matchinst,"cwin") == 0 || strcmp(matchinst,"swin") == 0) {
+      // The set is over, one way or the other. The instruction lives in the connection's
+      // buffer, so read it before closing.
+      bool won = strcmp(matchinst,"cwin") == 0;
+      free_board(board);
+      free(ours.cells);
+      free(theirs.cells);
+      conn_close(server);
       endwin();
-      printf("You lost the set. Better luck next time!\n");
+      if (won) {
+        printf("You won the set!\n");
+      } else {
+        printf("You lost the set. Better luck next time!\n");
+      }
       return 0;
     } else if (strcmp(matchinst,"setboard") == 0) {
       // Set the board for a new match
-      set_board(10+bonus,BLUE,board,w_board,w_status);
-      wclear(w_status);
+      double begin = stats_begin();
+      if (bot) {
+        bot_set_board(10+bonus,color,board,&ours,budget,server);
+        print_board(board,w_board,w_status);
+      } else {
+        set_board(10+bonus,color,board,&ours,w_board,w_status,server);
+      }
+      stats_end(PHASE_PLACE,begin);
+      werase(w_status);
       wprintw(w_status,"Waiting on opponent...");
       wrefresh(w_status);
 
-      // Send the board to the server
-      send_board(socket,board);
+      // Swap placements with the server and merge them into the board
+      if (send_placements(server,board,&ours) ||
+          recv_placements(server,board,&theirs)) {
+        endwin();
+        printf("Connection lost.\n");
+        return -1;
+      }
+      merge_placements(board,&ours,&theirs,opponent);
 
-      // Get the finalized board from the server
-      free(board);
-      board = recv_board(socket);
+      // Make sure the server ended up with the same board
+      begin = stats_begin();
+      char * serverhash = conn_receive_message(server);
+      stats_end(PHASE_EXCHANGE,begin);
+      if (serverhash == NULL) {
+        endwin();
+        printf("Connection lost.\n");
+        return -1;
+      }
+      char hash[HASH_LENGTH];
+      hash_string(board,hash);
+      if (strcmp(serverhash,hash) != 0) {
+        conn_send_message(server,"desynced");
+        conn_close(server);
+        endwin();
+        printf("Desynced, giving up.\n");
+        return -1;
+      }
 
       // Display it
       print_board(board,w_board,w_status);
-      wclear(w_status);
+      werase(w_status);
       wprintw(w_status,"Hit any key to begin.");
       wrefresh(w_status);
-      getch();
-      wclear(w_status);
+      if (!bot) wait_key(server);
+      werase(w_status);
       wprintw(w_status,"Waiting on opponent...");
       wrefresh(w_status);
 
       // Ready to start the match!
-      send_message(socket,"ready");
+      conn_send_message(server,"ready");
 
       // Store an instruction on whether to update or end the match
       char * updateinst;
 
-      while ((updateinst = receive_message(socket))) {
+      while ((updateinst = wait_on(server))) {
         // Server is gone
         if (updateinst == NULL) {
           endwin();
@@ -120,59 +248,80 @@ int main(int argc, char ** argv) {
         if (strcmp(updateinst,"update") == 0) {
           // We need to update the board
           update_board(board);
-          print_board(board,w_board,w_status);
+          animate_board(board,w_board,w_status);
+
+          // Send back a hash of our board to ensure we're synced
+          char hash[HASH_LENGTH];
+          hash_string(board,hash);
+          conn_send_message(server,hash);
+        } else if (strncmp(updateinst,"run ",4) == 0) {
+          // Play the whole round on our own, checking in with the server every so often and
+          // once more at the end
+          int checkpoint = atoi(updateinst + 4);
+          if (checkpoint < 1) checkpoint = 1;
+
+          round_t round;
+          start_round(&round,board);
+          while (step_round(&round,board)) {
+            animate_board(board,w_board,w_status);
+            conn_heartbeat(server);
 
-          // Potential to send back a hash to ensure we're synced
-          // Not implemented currently
-          // The "hash" is just the word hash
-          send_message(socket,"hash");
+            if (round.step % checkpoint == 0 || round.step == round.end) {
+              char hash[HASH_LENGTH];
+              char check[64];
+              hash_string(board,hash);
+              snprintf(check,sizeof(check),"%s %d %s",
+                       round.step == round.end ? "done" : "check",round.step,hash);
+              conn_send_message(server,check);
+              conn_flush(server);
+            }
+          }
+          print_board(board,w_board,w_status);
         } else if (strcmp(updateinst,"desynced") == 0) {
           // Server told us we're desynced
-          // Can't currently happen because the hash is unimplemented
           endwin();
           printf("Desynced, giving up.\n");
           return -1;
         } else if (strcmp(updateinst,"cwin") == 0) {
-          // Client won the match, yay
-          wclear(w_status);
+          // Client won the match, yay. Make sure the round's last frame is showing.
+          print_board(board,w_board,w_status);
+          werase(w_status);
           wprintw(w_status,"You won! Hit any key.");
           wrefresh(w_status);
-          getch();
-          wclear(w_status);
+          if (!bot) wait_key(server);
+          werase(w_status);
           wprintw(w_status,"Waiting on opponent...");
           wrefresh(w_status);
           // Done celebrating, ready for another 
-          send_message(socket,"ready");
+          conn_send_message(server,"ready");
           break; // Get another instruction on whether to start a new match
         } else if (strcmp(updateinst,"swin") == 0) {
           // We lost, boo
-          wclear(w_status);
+          print_board(board,w_board,w_status);
+          werase(w_status);
           wprintw(w_status,"You lost! Hit any key.");
           wrefresh(w_status);
           bonus += LOSS_BONUS;
-          getch();
-          wclear(w_status);
+          if (!bot) wait_key(server);
+          werase(w_status);
           wprintw(w_status,"Waiting on opponent...");
           wrefresh(w_status);
           // Done being sad, ready for another
-          send_message(socket,"ready");
+          conn_send_message(server,"ready");
           break; // Get another instruction on whether to start a new match
         } else if (strcmp(updateinst,"tie") == 0) {
-          wclear(w_status);
+          print_board(board,w_board,w_status);
+          werase(w_status);
           wprintw(w_status,"It's a tie! Hit any key.");
           wrefresh(w_status);
-          getch();
-          wclear(w_status);
+          if (!bot) wait_key(server);
+          werase(w_status);
           wprintw(w_status,"Waiting on opponent...");
           wrefresh(w_status);
-          send_message(socket,"ready");
+          conn_send_message(server,"ready");
           break; // Get another instruction on whether to start a new match
         }
-        // Clean-up
-        free(updateinst);
       }
     }
-    // Clean-up
-    free(matchinst);
   }
 }
@@ -1,308 +1,916 @@
+#include <stdio.h>
 #include <stdlib.h>
-#include <ncurses.h>
+#include <pthread.h>
 #include <string.h>
 
 #include "conway.h"
+#include "stats.h"
 
 // Check if coordinates are out of bounds
-bool outofbounds(int row, int column) {
-  return row < 0 || row >= BOARD_SIZE || column < 0 || column >= BOARD_SIZE;
+bool outofbounds(board_t board, int row, int column) {
+  return row < 0 || row >= board->height || column < 0 || column >= board->width;
 }
 
-// Create a blank board
-board_t create_board() {
-  // A board is BOARD_SIZE cell pointers (rows)
-  board_t board = (board_t) malloc(sizeof(cell_t *) * BOARD_SIZE);
+// Check if board dimensions are ones we are willing to play on
+bool valid_dimensions(int width, int height) {
+  return width > 0 && width <= MAX_BOARD_SIZE && height > 0 && height <= MAX_BOARD_SIZE;
+}
 
-  // Each row is BOARD_SIZE cells
-  for (int row = 0; row < BOARD_SIZE; row++) {
-    board[row] = (cell_t *) malloc(sizeof(cell_t) * BOARD_SIZE);
+// Create a blank board
+board_t create_board(int width, int height) {
+  if (!valid_dimensions(width, height)) return NULL;
+
+  board_t board = (board_t) malloc(sizeof(struct board));
+  if (board == NULL) return NULL;
+  board->width = width;
+  board->height = height;
+  board->words = (width + WORD_BITS - 1) / WORD_BITS;
+  board->hash = 0;
+  board->locked_hash = 0;
+
+  board->tile_rows = (height + TILE_ROWS - 1) / TILE_ROWS;
+
+  // All six planes live in one allocation, each starting on a cache line, followed by the two
+  // sets of tile flags
+  size_t plane = (size_t)board->height * board->words;
+  plane = (plane + PLANE_ALIGN / sizeof(uint64_t) - 1) & ~(PLANE_ALIGN / sizeof(uint64_t) - 1);
+  size_t tiles = (size_t)board->tile_rows * board->words;
+  size_t size = plane * 6 * sizeof(uint64_t) + tiles * 2;
+  void * cells;
+  if (posix_memalign(&cells, PLANE_ALIGN, size)) {
+    free(board);
+    return NULL;
   }
+  memset(cells, 0, size);
+
+  board->cells = (uint64_t *) cells;
+  board->red = board->cells;
+  board->blue = board->cells + plane;
+  board->locked = board->cells + plane * 2;
+  board->next_red = board->cells + plane * 3;
+  board->next_blue = board->cells + plane * 4;
+  board->next_locked = board->cells + plane * 5;
+  board->active = (uint8_t *)(board->cells + plane * 6);
+  board->next_active = board->active + tiles;
 
   return board;
 }
 
+// Index of the word holding a cell, and the cell's bit within it
+static inline size_t word_index(board_t board, int row, int column) {
+  return (size_t)row * board->words + column / WORD_BITS;
+}
+
+static inline uint64_t bit_mask(int column) {
+  return (uint64_t)1 << (column % WORD_BITS);
+}
+
 // Return a copy of a cell at a location
 cell_t get_cell(board_t board, int row, int column) {
-  if (outofbounds(row,column)) {
-    cell_t out_of_bounds;
-    out_of_bounds.alive = false;
-    out_of_bounds.color = COLORLESS;
-    return out_of_bounds;
-  }
-
-  cell_t boardcell = board[column][row];
   cell_t answer;
-  answer.alive = boardcell.alive;
-  answer.color = boardcell.color;
+  answer.alive = false;
+  answer.color = COLORLESS;
+  answer.locked = false;
+  if (outofbounds(board,row,column)) return answer;
+
+  size_t i = word_index(board, row, column);
+  uint64_t bit = bit_mask(column);
+  if (board->red[i] & bit) {
+    answer.alive = true;
+    answer.color = RED;
+  } else if (board->blue[i] & bit) {
+    answer.alive = true;
+    answer.color = BLUE;
+  }
+  answer.locked = (board->locked[i] & bit) != 0;
   return answer;
 }
 
-// Mark a cell to be made alive
-void spawn(board_t board, int row, int column, int color) {
-  if (outofbounds(row,column)) return;
-  board[column][row].future = true;
-  board[column][row].locked = true;
-  board[column][row].color = color;
-}
-
-// Mark a cell to be killed
-void kill(board_t board, int row, int column) {
-  if (outofbounds(row,column)) return;
-  board[column][row].future = false;
-  board[column][row].locked = false;
-}
-
-// Mark a cell appropriately depending on the rules of conway
-void update_cell(board_t board, int row, int column) {
-  int neighbors = 0;
-  int reds = 0;
-  int blues = 0;
-  for (int r = row-1; r <= row+1; r++) {
-    for (int c = column-1; c <= column+1; c++) {
-      if (r != row || c != column) {
-        cell_t neighbor = get_cell(board,r,c);
-        if (neighbor.alive) {
-          neighbors++;
-          if (neighbor.color == BLUE) blues++;
-          if (neighbor.color == RED) reds++;
+// Set the contents of a cell
+void set_cell(board_t board, int row, int column, int color, bool locked) {
+  if (outofbounds(board,row,column)) return;
+  size_t i = word_index(board, row, column);
+  uint64_t bit = bit_mask(column);
+  if (board->red[i] & bit) board->hash ^= cell_key(row, column, RED);
+  if (board->blue[i] & bit) board->hash ^= cell_key(row, column, BLUE);
+  if (color == RED || color == BLUE) board->hash ^= cell_key(row, column, color);
+  if (board->locked[i] & bit) board->locked_hash ^= lock_key(row, column);
+  if (locked) board->locked_hash ^= lock_key(row, column);
+  board->red[i] &= ~bit;
+  board->blue[i] &= ~bit;
+  board->locked[i] &= ~bit;
+  if (color == RED) board->red[i] |= bit;
+  if (color == BLUE) board->blue[i] |= bit;
+  if (locked) board->locked[i] |= bit;
+
+  // Make sure the next update looks at this cell and its neighbors
+  board->active[(row / TILE_ROWS) * board->words + column / WORD_BITS] = 1;
+}
+
+// Kill every cell on the board
+void clear_board(board_t board) {
+  size_t plane = (size_t)board->height * board->words;
+  memset(board->red, 0, plane * sizeof(uint64_t));
+  memset(board->blue, 0, plane * sizeof(uint64_t));
+  memset(board->locked, 0, plane * sizeof(uint64_t));
+  memset(board->active, 1, (size_t)board->tile_rows * board->words);
+  board->hash = 0;
+  board->locked_hash = 0;
+}
+
+// Fill a board at random, the same way every time for a seed
+void fill_board(board_t board, double density, uint64_t seed) {
+  uint64_t state = seed * 0x9e3779b97f4a7c15ULL + 1;
+  uint64_t threshold = (uint64_t)(density * 4294967296.0);
+  clear_board(board);
+  for (int row = 0; row < board->height; row++) {
+    for (int column = 0; column < board->width; column++) {
+      uint64_t value = next_random(&state);
+      if ((value & 0xffffffff) < threshold) {
+        set_cell(board, row, column, (value >> 32) & 1 ? RED : BLUE, false);
+      }
+    }
+  }
+}
+
+// Copy one board onto another of the same size
+void copy_board(board_t dest, board_t source) {
+  size_t plane = (size_t)source->height * source->words;
+  memcpy(dest->red, source->red, plane * sizeof(uint64_t));
+  memcpy(dest->blue, source->blue, plane * sizeof(uint64_t));
+  memcpy(dest->locked, source->locked, plane * sizeof(uint64_t));
+  // A sleeping tile is only skipped because its scratch planes already hold it, and dest's hold
+  // whatever it had before, so every tile has to be looked at on the next update
+  memset(dest->active, 1, (size_t)source->tile_rows * source->words);
+  dest->hash = source->hash;
+  dest->locked_hash = source->locked_hash;
+}
+
+// Make a cell alive
+void spawn_cell(board_t board, int row, int column, int color) {
+  set_cell(board, row, column, color, true);
+}
+
+// Kill a cell
+void kill_cell(board_t board, int row, int column) {
+  set_cell(board, row, column, COLORLESS, false);
+}
+
+// Add three bit-sliced one-bit numbers, giving a sum bit and a carry bit
+static inline void add3(uint64_t a, uint64_t b, uint64_t c, uint64_t * sum, uint64_t * carry) {
+  uint64_t ab = a ^ b;
+  *sum = ab ^ c;
+  *carry = (a & b) | (ab & c);
+}
+
+// Fetch a word of a plane, treating anything off the board as dead
+static inline uint64_t plane_word(board_t board, const uint64_t * plane, int row, int word) {
+  if (row < 0 || row >= board->height || word < 0 || word >= board->words) return 0;
+  return plane[(size_t)row * board->words + word];
+}
+
+// The eight neighbors of a word's cells, each lined up with the cells themselves
+static inline void gather_neighbors(board_t board, const uint64_t * plane, int row, int word,
+                                    uint64_t n[8]) {
+  for (int r = -1, k = 0; r <= 1; r++) {
+    uint64_t mid = plane_word(board, plane, row + r, word);
+    uint64_t west = (mid << 1) | (plane_word(board, plane, row + r, word - 1) >> (WORD_BITS - 1));
+    uint64_t east = (mid >> 1) | (plane_word(board, plane, row + r, word + 1) << (WORD_BITS - 1));
+    n[k++] = west;
+    n[k++] = east;
+    if (r != 0) n[k++] = mid;
+  }
+}
+
+// Compute the next generation of one word of the board, applying the rules of conway to 64
+// cells at once. Survival is the usual 2 or 3 neighbors and keeps the cell's color and lock.
+// A birth needs exactly 3 neighbors, takes the majority color among them, and is locked.
+// Returns whether any of the 64 cells changed, and folds the births and deaths into hash and the
+// cells that were locked or unlocked into locked_hash.
+static bool update_word(board_t board, int row, int word, uint64_t * hash,
+                        uint64_t * locked_hash) {
+  size_t i = (size_t)row * board->words + word;
+  uint64_t red = board->red[i];
+  uint64_t blue = board->blue[i];
+  uint64_t alive = red | blue;
+
+  uint64_t n[8];
+  uint64_t r[8];
+  uint64_t b[8];
+  gather_neighbors(board, board->red, row, word, r);
+  gather_neighbors(board, board->blue, row, word, b);
+  for (int k = 0; k < 8; k++) n[k] = r[k] | b[k];
+
+  // Count live neighbors modulo 8. Eight neighbors reads as zero, which is still a death.
+  uint64_t s0, c0, s1, c1, s2, c2;
+  add3(n[0], n[1], n[2], &s0, &c0);
+  add3(n[3], n[4], n[5], &s1, &c1);
+  add3(n[6], n[7], 0, &s2, &c2);
+  uint64_t ones, k1;
+  add3(s0, s1, s2, &ones, &k1);
+  uint64_t t, fours;
+  add3(c0, c1, c2, &t, &fours);
+  uint64_t twos = t ^ k1;
+  fours ^= t & k1;
+
+  // At least two red neighbors. With three neighbors in total, that makes red the majority.
+  uint64_t red_seen = 0;
+  uint64_t red_major = 0;
+  for (int k = 0; k < 8; k++) {
+    red_major |= red_seen & r[k];
+    red_seen |= r[k];
+  }
+
+  uint64_t survive = alive & twos & ~fours;
+  uint64_t born = ~alive & ones & twos & ~fours;
+
+  uint64_t edge = ~(uint64_t)0;
+  if (word == board->words - 1 && board->width % WORD_BITS != 0) {
+    edge = ((uint64_t)1 << (board->width % WORD_BITS)) - 1;
+  }
+  born &= edge;
+
+  uint64_t next_red = (red & survive) | (born & red_major);
+  uint64_t next_blue = (blue & survive) | (born & ~red_major);
+  uint64_t next_locked = (board->locked[i] & survive) | born;
+  board->next_red[i] = next_red;
+  board->next_blue[i] = next_blue;
+  board->next_locked[i] = next_locked;
+
+  uint64_t red_changes = next_red ^ red;
+  uint64_t blue_changes = next_blue ^ blue;
+  uint64_t locked_changes = next_locked ^ board->locked[i];
+  while (red_changes) {
+    *hash ^= cell_key(row, word * WORD_BITS + __builtin_ctzll(red_changes), RED);
+    red_changes &= red_changes - 1;
+  }
+  while (blue_changes) {
+    *hash ^= cell_key(row, word * WORD_BITS + __builtin_ctzll(blue_changes), BLUE);
+    blue_changes &= blue_changes - 1;
+  }
+  while (locked_changes) {
+    *locked_hash ^= lock_key(row, word * WORD_BITS + __builtin_ctzll(locked_changes));
+    locked_changes &= locked_changes - 1;
+  }
+
+  return ((next_red ^ red) | (next_blue ^ blue) | (next_locked ^ board->locked[i])) != 0;
+}
+
+// Whether a tile or any of its neighbors changed last generation
+static bool tile_awake(board_t board, int tile_row, int word) {
+  for (int r = tile_row - 1; r <= tile_row + 1; r++) {
+    if (r < 0 || r >= board->tile_rows) continue;
+    for (int w = word - 1; w <= word + 1; w++) {
+      if (w < 0 || w >= board->words) continue;
+      if (board->active[r * board->words + w]) return true;
+    }
+  }
+  return false;
+}
+
+// Update a band of tile rows of the board. A tile that sleeps through a generation is left
+// alone: nothing that could affect it changed last time, so the scratch planes, which hold the
+// generation before, already match it. The changes to the board's hashes are folded into hash
+// and locked_hash.
+static void update_rows(board_t board, int first, int last, uint64_t * hash,
+                        uint64_t * locked_hash) {
+  for (int tile_row = first; tile_row < last; tile_row++) {
+    int end = (tile_row + 1) * TILE_ROWS;
+    if (end > board->height) end = board->height;
+
+    for (int word = 0; word < board->words; word++) {
+      bool changed = false;
+      if (tile_awake(board, tile_row, word)) {
+        for (int row = tile_row * TILE_ROWS; row < end; row++) {
+          changed |= update_word(board, row, word, hash, locked_hash);
         }
       }
+      board->next_active[tile_row * board->words + word] = changed;
     }
   }
+}
+
+// Persistent worker threads that split each generation into bands of rows. The caller of
+// update_board works the first band itself, so a pool of n threads has n-1 workers.
+static struct {
+  pthread_mutex_t busy;      // Held for the duration of a parallel update
+  pthread_mutex_t lock;
+  pthread_cond_t start;      // Signalled when a new generation is posted
+  pthread_cond_t done;       // Signalled when the last worker finishes its band
+  pthread_t * workers;
+  int threads;
+  unsigned long generation;  // Bumped once per posted generation
+  unsigned long started;     // The generation when the workers were started
+  int remaining;             // Workers still busy with the current generation
+  uint64_t hash;             // The workers' changes to the board's hashes
+  uint64_t locked_hash;
+  board_t board;
+  bool quit;
+} pool = {
+  .busy = PTHREAD_MUTEX_INITIALIZER,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .start = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+  .threads = 1
+};
+
+// First tile row of a thread's band
+static int band_start(board_t board, int index) {
+  return (int)((long)board->tile_rows * index / pool.threads);
+}
 
-  cell_t target = get_cell(board, row, column);
+static void * pool_worker(void * arg) {
+  int index = (int)(intptr_t)arg;
+  unsigned long seen = pool.started;
 
-  if (target.alive && neighbors != 2 && neighbors != 3) {
-    kill(board, row, column);
+  pthread_mutex_lock(&pool.lock);
+  while (true) {
+    while (pool.generation == seen && !pool.quit) {
+      pthread_cond_wait(&pool.start, &pool.lock);
+    }
+    if (pool.quit) break;
+    seen = pool.generation;
+    board_t board = pool.board;
+    pthread_mutex_unlock(&pool.lock);
+
+    uint64_t hash = 0;
+    uint64_t locked_hash = 0;
+    update_rows(board, band_start(board, index), band_start(board, index + 1), &hash,
+                &locked_hash);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.hash ^= hash;
+    pool.locked_hash ^= locked_hash;
+    if (--pool.remaining == 0) pthread_cond_signal(&pool.done);
   }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
 
-  if (!target.alive && neighbors == 3) {
-    if (blues > reds) {
-      spawn(board, row, column, BLUE);
-    } else if (reds > blues) {
-      spawn(board, row, column, RED);
+// Stop and join every worker
+static void pool_stop() {
+  pthread_mutex_lock(&pool.lock);
+  pool.quit = true;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int i = 1; i < pool.threads; i++) {
+    pthread_join(pool.workers[i], NULL);
+  }
+  free(pool.workers);
+  pool.workers = NULL;
+  pool.threads = 1;
+  pool.quit = false;
+}
+
+// Set how many threads update_board uses. Returns the number actually running.
+int set_update_threads(int threads) {
+  if (threads < 1) threads = 1;
+
+  pthread_mutex_lock(&pool.busy);
+  if (pool.threads > 1) pool_stop();
+
+  // Without room to keep track of workers, updates stay serial
+  if (threads > 1) pool.workers = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+  if (threads > 1 && pool.workers != NULL) {
+    pool.threads = threads;
+    pool.started = pool.generation;
+    for (int i = 1; i < threads; i++) {
+      if (pthread_create(&pool.workers[i], NULL, pool_worker, (void *)(intptr_t)i)) {
+        // Keep the workers we did get
+        pool.threads = i;
+        break;
+      }
     }
   }
+  if (pool.threads == 1) {
+    free(pool.workers);
+    pool.workers = NULL;
+  }
+  threads = pool.threads;
+  pthread_mutex_unlock(&pool.busy);
+
+  return threads;
 }
 
 // Update the board once
 void update_board(board_t board) {
-  for (int row = 0; row < BOARD_SIZE; row++) {
-    for (int column = 0; column < BOARD_SIZE; column++) {
-      update_cell(board, row, column);
+  double begin = stats_begin();
+
+  // Only one board can use the pool at a time. Anyone else updates serially.
+  if (pool.threads > 1 && pthread_mutex_trylock(&pool.busy) == 0) {
+    if (pool.threads > 1) {
+      pthread_mutex_lock(&pool.lock);
+      pool.board = board;
+      pool.remaining = pool.threads - 1;
+      pool.hash = 0;
+      pool.locked_hash = 0;
+      pool.generation++;
+      pthread_cond_broadcast(&pool.start);
+      pthread_mutex_unlock(&pool.lock);
+
+      update_rows(board, 0, band_start(board, 1), &board->hash, &board->locked_hash);
+
+      pthread_mutex_lock(&pool.lock);
+      while (pool.remaining > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+      }
+      board->hash ^= pool.hash;
+      board->locked_hash ^= pool.locked_hash;
+      pthread_mutex_unlock(&pool.lock);
+    } else {
+      update_rows(board, 0, board->tile_rows, &board->hash, &board->locked_hash);
     }
+    pthread_mutex_unlock(&pool.busy);
+  } else {
+    update_rows(board, 0, board->tile_rows, &board->hash, &board->locked_hash);
   }
 
-  for (int row = 0; row < BOARD_SIZE; row++) {
-    for (int column = 0; column < BOARD_SIZE; column++) {
-      board[row][column].alive = board[row][column].future;
-      board[row][column].future = board[row][column].alive;
-    }
-  }
+  // The scratch planes now hold the new generation, so swap them in
+  uint64_t * swap;
+  swap = board->red; board->red = board->next_red; board->next_red = swap;
+  swap = board->blue; board->blue = board->next_blue; board->next_blue = swap;
+  swap = board->locked; board->locked = board->next_locked; board->next_locked = swap;
+  uint8_t * flags = board->active;
+  board->active = board->next_active;
+  board->next_active = flags;
+
+  stats_end(PHASE_UPDATE, begin);
 }
 
 // Destroy the board
 void free_board(board_t board) {
-  for (int row = 0; row < BOARD_SIZE; row++) {
-    free(board[row]);
-  }
+  free(board->cells);
   free(board);
 }
 
-// Render the board to an ncurses window
-score_t display_board(board_t board, WINDOW * w_board) {
+// Boards given back for reuse. They are taken newest first, so the one handed out is the most
+// likely to still be in cache.
+static struct {
+  pthread_mutex_t lock;
+  board_t boards[BOARD_POOL_SIZE];
+  int count;
+} board_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Get a blank board, reusing one of the same size from the pool if there is one
+board_t acquire_board(int width, int height) {
+  board_t board = NULL;
+  pthread_mutex_lock(&board_pool.lock);
+  for (int i = board_pool.count - 1; i >= 0; i--) {
+    if (board_pool.boards[i]->width == width && board_pool.boards[i]->height == height) {
+      board = board_pool.boards[i];
+      board_pool.count--;
+      memmove(board_pool.boards + i, board_pool.boards + i + 1,
+              sizeof(board_t) * (board_pool.count - i));
+      break;
+    }
+  }
+  pthread_mutex_unlock(&board_pool.lock);
+
+  if (board == NULL) return create_board(width, height);
+  clear_board(board);
+  return board;
+}
+
+// Give a board back to the pool, or free it if the pool is full. The oldest board makes way for
+// it, so boards of a size no longer in use don't hold on to their slots.
+void release_board(board_t board) {
+  if (board == NULL) return;
+  board_t evicted = NULL;
+  pthread_mutex_lock(&board_pool.lock);
+  if (board_pool.count == BOARD_POOL_SIZE) {
+    evicted = board_pool.boards[0];
+    memmove(board_pool.boards, board_pool.boards + 1, sizeof(board_t) * (BOARD_POOL_SIZE - 1));
+    board_pool.count--;
+  }
+  board_pool.boards[board_pool.count++] = board;
+  pthread_mutex_unlock(&board_pool.lock);
+  if (evicted != NULL) free_board(evicted);
+}
+
+// Free every board in the pool
+void drain_board_pool() {
+  pthread_mutex_lock(&board_pool.lock);
+  while (board_pool.count > 0) free_board(board_pool.boards[--board_pool.count]);
+  pthread_mutex_unlock(&board_pool.lock);
+}
+
+// The rule entry for a cell. Survival is 2 or 3 neighbors and keeps the cell's color and lock.
+// A birth needs exactly 3 neighbors, takes the majority color among them, and is locked.
+uint8_t rule_entry(bool alive, int neighbors, int reds) {
+  if (alive) return (neighbors == 2 || neighbors == 3) ? (RED | BLUE | RULE_LOCKED) << 4 : 0;
+  if (neighbors == 3) return (reds >= 2 ? RED : BLUE) | RULE_LOCKED;
+  return 0;
+}
+
+static uint8_t neighborhoods[RULE_NEIGHBORHOODS];
+static pthread_once_t neighborhoods_once = PTHREAD_ONCE_INIT;
+
+static void build_rule_table() {
+  for (int index = 0; index < RULE_NEIGHBORHOODS; index++) {
+    int neighbors = 0;
+    int reds = 0;
+    for (int cell = 0; cell < 9; cell++) {
+      int color = index >> (2 * cell) & 3;
+      if (cell == 4 || (color != RED && color != BLUE)) continue;
+      neighbors++;
+      if (color == RED) reds++;
+    }
+    int center = index >> 8 & 3;
+    neighborhoods[index] = rule_entry(center == RED || center == BLUE, neighbors, reds);
+  }
+}
+
+// The rule entry for every 3x3 neighborhood
+const uint8_t * rule_table() {
+  pthread_once(&neighborhoods_once, build_rule_table);
+  return neighborhoods;
+}
+
+// Write the board hash as text, for comparing with the other player
+void hash_string(board_t board, char buffer[HASH_LENGTH]) {
+  snprintf(buffer, HASH_LENGTH, "%016llx", (unsigned long long)board->hash);
+}
+
+// Fingerprint a board. Both hashes are kept up to date as cells change, so this costs nothing
+// however big the board is.
+uint64_t board_fingerprint(board_t board) {
+  return board->hash ^ board->locked_hash;
+}
+
+// Count the live cells of each color
+score_t count_board(board_t board) {
+  size_t plane = (size_t)board->height * board->words;
   score_t score;
   score.red = 0;
   score.blue = 0;
-  
-  wclear(w_board);
-  
-  //init_pair(RED,COLOR_RED,COLOR_BLACK);
-  //init_pair(BLUE,COLOR_CYAN,COLOR_BLACK);
-  init_pair(RED,COLOR_BLACK,COLOR_RED);
-  init_pair(BLUE,COLOR_BLACK,COLOR_CYAN);
-  for (int row = 0; row < BOARD_SIZE; row++) {
-    for (int col = 0; col < BOARD_SIZE; col++) {
-      cell_t cell = get_cell(board,row,col);
-      if (cell.alive) {
-        wattrset(w_board,COLOR_PAIR(cell.color));
-        if (cell.color == RED) {
-          score.red++;
-          mvwaddch(w_board,row,col,'#');
-        } else {
-          score.blue++;
-          mvwaddch(w_board,row,col,'@');
-        }
+  for (size_t i = 0; i < plane; i++) {
+    score.red += __builtin_popcountll(board->red[i]);
+    score.blue += __builtin_popcountll(board->blue[i]);
+  }
+  score.diff = score.red - score.blue;
+  return score;
+}
+
+// Begin a round on a board
+void start_round(round_t * round, board_t board) {
+  round->step = 0;
+  round->end = MATCH_STEPS;
+  round->history[0] = board_fingerprint(board);
+}
+
+// Play the next generation of a round
+bool step_round(round_t * round, board_t board) {
+  if (round->step >= round->end) return false;
+
+  update_board(board);
+  round->step++;
+  uint64_t fingerprint = board_fingerprint(board);
+
+  // Look for this generation among the recent ones. If it turned up period generations ago, the
+  // board repeats from here on, and the final generation looks like one a few steps ahead.
+  if (round->end == MATCH_STEPS) {
+    for (int period = 1; period <= HISTORY_LENGTH && period <= round->step; period++) {
+      if (round->history[(round->step - period) % HISTORY_LENGTH] == fingerprint) {
+        round->end = round->step + (MATCH_STEPS - round->step) % period;
+        break;
       }
     }
   }
-  wattrset(w_board,A_NORMAL);
+  round->history[round->step % HISTORY_LENGTH] = fingerprint;
 
-  score.diff = score.red - score.blue;
-  return score;
+  return true;
 }
 
-// Print out both the board and the status line
-score_t print_board(board_t board, WINDOW * w_board, WINDOW * w_status) {
+// Append a number to a buffer as a varint: seven bits per byte, low bits first, with the high
+// bit set on every byte but the last. Returns the number of bytes written.
+size_t put_varint(uint8_t * out, uint64_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
 
-  score_t score = display_board(board, w_board);
+// The number of bytes put_varint would write
+static size_t varint_size(uint64_t value) {
+  size_t n = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    n++;
+  }
+  return n;
+}
 
-  wclear(w_status);
+// Read a varint, advancing *in. Returns false if it runs past the end.
+bool get_varint(const uint8_t ** in, const uint8_t * end, uint64_t * value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *in < end; shift += 7) {
+    uint8_t byte = *(*in)++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
 
-  if (score.diff > 0) {
-    wprintw(w_status,"Red is up by %d.",score.diff);
-  } else if (score.diff < 0) {
-    wprintw(w_status,"Blue is up by %d.",score.diff*-1);
+// Encode a board as a snapshot
+uint8_t * encode_board(board_t board, size_t * len) {
+  size_t cells = (size_t)board->width * board->height;
+
+  // A list gives each live cell as the gap since the last one, with the color in the low bit.
+  // Work out how long that would be, to compare with a bitmap.
+  size_t list_size = 0;
+  size_t live = 0;
+  uint64_t last = 0;
+  for (int row = 0; row < board->height; row++) {
+    for (int word = 0; word < board->words; word++) {
+      size_t i = (size_t)row * board->words + word;
+      uint64_t alive = board->red[i] | board->blue[i];
+      while (alive) {
+        uint64_t index = (uint64_t)row * board->width + word * WORD_BITS + __builtin_ctzll(alive);
+        list_size += varint_size((index - last) << 1);
+        last = index + 1;
+        live++;
+        alive &= alive - 1;
+      }
+    }
+  }
+  list_size += varint_size(live);
+  size_t bitmap_size = (cells + 7) / 8 * 2;
+  bool bitmap = bitmap_size < list_size;
+
+  uint8_t * out = (uint8_t *) malloc(1 + 2 * 10 + (bitmap ? bitmap_size : list_size));
+  if (out == NULL) return NULL;
+  size_t n = 0;
+  out[n++] = bitmap ? SNAPSHOT_BITMAP : SNAPSHOT_LIST;
+  n += put_varint(out + n, board->width);
+  n += put_varint(out + n, board->height);
+
+  if (bitmap) {
+    // The red plane then the blue plane, each packed row after row with no padding
+    memset(out + n, 0, bitmap_size);
+    uint64_t * planes[2] = {board->red, board->blue};
+    for (int p = 0; p < 2; p++) {
+      uint8_t * bits = out + n + p * bitmap_size / 2;
+      size_t bit = 0;
+      for (int row = 0; row < board->height; row++) {
+        for (int word = 0; word < board->words; word++) {
+          uint64_t value = planes[p][(size_t)row * board->words + word];
+          int count = board->width - word * WORD_BITS;
+          if (count > WORD_BITS) count = WORD_BITS;
+          while (value) {
+            int b = __builtin_ctzll(value);
+            size_t at = bit + b;
+            bits[at / 8] |= (uint8_t)(1 << (at % 8));
+            value &= value - 1;
+          }
+          bit += count;
+        }
+      }
+    }
+    n += bitmap_size;
   } else {
-    wprintw(w_status,"Red and Blue are tied!");
+    n += put_varint(out + n, live);
+    last = 0;
+    for (int row = 0; row < board->height; row++) {
+      for (int word = 0; word < board->words; word++) {
+        size_t i = (size_t)row * board->words + word;
+        uint64_t alive = board->red[i] | board->blue[i];
+        while (alive) {
+          int b = __builtin_ctzll(alive);
+          uint64_t index = (uint64_t)row * board->width + word * WORD_BITS + b;
+          uint64_t blue = (board->blue[i] >> b) & 1;
+          n += put_varint(out + n, (index - last) << 1 | blue);
+          last = index + 1;
+          alive &= alive - 1;
+        }
+      }
+    }
   }
 
-  wrefresh(w_board);
-  wrefresh(w_status);
-
-  return score;
+  *len = n;
+  return out;
 }
 
-// Allow the user to select a spot to place a cell
-int place_cell(int color, board_t board, WINDOW * w_board, WINDOW * w_status) {
-  wrefresh(w_board);
-  int y;
-  int x;
-  getyx(w_board,y,x);
-  int c;
-  bool placing = true;
-  while ((c=getch()) && placing) {
-    switch (c) {
-    case KEY_LEFT:
-    case 'h':
-      x--;
-      break;
-    case KEY_RIGHT:
-    case 'l':
-      x++;
-      break;
-    case KEY_UP:
-    case 'k':
-      y--;
-      break;
-    case KEY_DOWN:
-    case 'j':
-      y++;
-      break;
-    case 'b':
-      x--;
-      y++;
-      break;
-    case 'n':
-      x++;
-      y++;
-      break;
-    case 'y':
-      x--;
-      y--;
-      break;
-    case 'u':
-      x++;
-      y--;
-      break;
-    case 'z':
-    case '\n':
-    case '.':
-    case KEY_ENTER:
-      if (board[x][y].alive && board[x][y].color == color && !(board[x][y].locked)) {
-        board[x][y].color = COLORLESS;
-        board[x][y].alive = false;
-        board[x][y].future = false;
-	board[x][y].locked = false;
-
-        display_board(board,w_board);
-        wmove(w_board,y,x);
-        wrefresh(w_board);
-
-        return -1;
-      } else if (!board[x][y].alive) {
-        board[x][y].color = color;
-        board[x][y].alive = true;
-        board[x][y].future = true;
-	board[x][y].locked = false;
-
-        display_board(board,w_board);
-        wmove(w_board,y,x);
-        wrefresh(w_board);
-
-        return 1;
-      } else {
-        break;
+// Decode a snapshot into a board from the pool
+board_t decode_board(const uint8_t * data, size_t len) {
+  const uint8_t * end = data + len;
+  if (len < 1) return NULL;
+  uint8_t format = *data++;
+
+  uint64_t width;
+  uint64_t height;
+  if (!get_varint(&data, end, &width) || !get_varint(&data, end, &height)) return NULL;
+  // Bound both while they are still 64 bits, so a huge one can't pass as a small int
+  if (width > MAX_BOARD_SIZE || height > MAX_BOARD_SIZE ||
+      !valid_dimensions((int)width, (int)height)) {
+    return NULL;
+  }
+
+  board_t board = acquire_board((int)width, (int)height);
+  if (board == NULL) return NULL;
+  size_t cells = (size_t)width * height;
+
+  if (format == SNAPSHOT_BITMAP) {
+    size_t plane = (cells + 7) / 8;
+    if ((size_t)(end - data) != plane * 2) {
+      release_board(board);
+      return NULL;
+    }
+    for (size_t index = 0; index < cells; index++) {
+      int row = index / width;
+      int column = index % width;
+      if (data[index / 8] >> (index % 8) & 1) {
+        set_cell(board, row, column, RED, false);
+      } else if (data[plane + index / 8] >> (index % 8) & 1) {
+        set_cell(board, row, column, BLUE, false);
       }
-    case 'q':
-      return 0;
     }
-    
-    if (x<0) x=0;
-    if (x>=BOARD_SIZE) x=BOARD_SIZE-1;
-    if (y<0) y=0;
-    if (y>=BOARD_SIZE) y=BOARD_SIZE-1;
-
-    display_board(board,w_board);
-    wmove(w_board,y,x);
-    wrefresh(w_board);
-  }
-  return 1;
-}
-
-// Allow the user to set the board
-void set_board(int count, int color, board_t board, WINDOW * w_board, WINDOW * w_status) {
-  curs_set(1);
-  for (int i = 0; i < count; i++) {
-    wclear(w_status);
-    wprintw(w_status,"%d cells remaining.",count-i);
-    wrefresh(w_status);
-    int cont = place_cell(color,board,w_board,w_status);
-    if (cont == -1) {
-      i-=2;
+  } else if (format == SNAPSHOT_LIST) {
+    uint64_t live;
+    if (!get_varint(&data, end, &live) || live > cells) {
+      release_board(board);
+      return NULL;
     }
-    if (!cont) break;
+    uint64_t index = 0;
+    for (uint64_t i = 0; i < live; i++) {
+      uint64_t entry;
+      if (!get_varint(&data, end, &entry) || (entry >> 1) >= cells - index) {
+        release_board(board);
+        return NULL;
+      }
+      index += entry >> 1;
+      set_cell(board, index / width, index % width, (entry & 1) ? BLUE : RED, false);
+      index++;
+    }
+  } else {
+    release_board(board);
+    return NULL;
   }
-  curs_set(0);
+
+  return board;
 }
 
 // Send a board over a socket
-void send_board(int fd, board_t board) {
-  char * message = malloc(sizeof(char)*4);
-  message[3]=0;
-  for (int x = 0; x < BOARD_SIZE; x++) {
-    for (int y = 0; y < BOARD_SIZE; y++) {
-      if (board[x][y].alive) {
-	message[0] = (char)(board[x][y].color);
-	message[1] = (char)x;
-	message[2] = (char)y;
-	int success = send_message(fd,message);
-	if (success == -1) exit(-1);
+void send_board(conn_t * conn, board_t board) {
+  double begin = stats_begin();
+  size_t len;
+  uint8_t * snapshot = encode_board(board, &len);
+  if (snapshot == NULL || conn_send(conn, snapshot, len)) exit(-1);
+  free(snapshot);
+  stats_end(PHASE_EXCHANGE, begin);
+}
+
+// Receive a board over a socket
+board_t recv_board(conn_t * conn, int width, int height) {
+  double begin = stats_begin();
+  size_t len;
+  char * message = conn_receive(conn, &len);
+  if (message == NULL) exit(7);
+
+  board_t newboard = decode_board((uint8_t *) message, len);
+  if (newboard == NULL || newboard->width != width || newboard->height != height) exit(7);
+  stats_end(PHASE_EXCHANGE, begin);
+
+  return newboard;
+}
+
+// Note that a player placed a cell, or took one back
+void record_placement(placements_t * placements, int row, int column, int color) {
+  // Taking back a cell undoes placing it, and placing a cell undoes taking it back
+  for (int i = 0; i < placements->count; i++) {
+    placement_t * p = &placements->cells[i];
+    if (p->row == row && p->column == column) {
+      *p = placements->cells[--placements->count];
+      return;
+    }
+  }
+
+  if (placements->count == placements->capacity) {
+    int capacity = placements->capacity ? placements->capacity * 2 : 32;
+    placement_t * cells = (placement_t *) realloc(placements->cells, sizeof(placement_t) * capacity);
+    if (cells == NULL) exit(-1);
+    placements->cells = cells;
+    placements->capacity = capacity;
+  }
+
+  placement_t * p = &placements->cells[placements->count++];
+  p->row = row;
+  p->column = column;
+  p->color = color;
+}
+
+// Apply the other player's placements to a board that already has ours
+void merge_placements(board_t board, placements_t * ours, placements_t * theirs, int color) {
+  for (int i = 0; i < theirs->count; i++) {
+    placement_t * p = &theirs->cells[i];
+    cell_t cell = get_cell(board,p->row,p->column);
+    if (p->color == COLORLESS) {
+      // They took back one of their own cells
+      if (cell.alive && cell.color == color && !cell.locked) {
+        set_cell(board,p->row,p->column,COLORLESS,false);
+      }
+    } else if (p->color == color && !cell.alive) {
+      set_cell(board,p->row,p->column,color,false);
+    } else if (p->color == color) {
+      // If we both placed a cell here, they cancel out
+      for (int j = 0; j < ours->count; j++) {
+        if (ours->cells[j].row == p->row && ours->cells[j].column == p->column &&
+            ours->cells[j].color != COLORLESS) {
+          set_cell(board,p->row,p->column,COLORLESS,false);
+        }
       }
     }
   }
-  send_message(fd,"000");
+}
+
+// Send our placements as one message: the count, then for each the cell's index on the board
+// shifted past its two color bits, all as varints
+int send_placements(conn_t * conn, board_t board, placements_t * placements) {
+  double begin = stats_begin();
+  size_t n;
+  uint8_t * message = encode_placements(board, placements, &n);
+  if (message == NULL) return -1;
+
+  int rc = conn_send(conn, message, n);
   free(message);
+  stats_end(PHASE_EXCHANGE, begin);
+  return rc;
 }
 
-// Receive a board over a socket
-board_t recv_board(int fd) {
-  board_t newboard = create_board();
+// Encode placements as a message
+uint8_t * encode_placements(board_t board, placements_t * placements, size_t * len) {
+  uint8_t * message = (uint8_t *) malloc(1 + 10 * (1 + (size_t)placements->count));
+  if (message == NULL) return NULL;
+
+  size_t n = 0;
+  message[n++] = PLACEMENTS;
+  n += put_varint(message + n, placements->count);
+  for (int i = 0; i < placements->count; i++) {
+    placement_t * p = &placements->cells[i];
+    uint64_t index = (uint64_t)p->row * board->width + p->column;
+    n += put_varint(message + n, index << 2 | p->color);
+  }
 
-  char * message;
+  *len = n;
+  return message;
+}
 
-  while (true) {
-    message = receive_message(fd);
+// Receive the other player's placements
+int recv_placements(conn_t * conn, board_t board, placements_t * placements) {
+  double begin = stats_begin();
+  size_t len;
+  char * message = conn_receive(conn, &len);
+  if (message == NULL) return -1;
 
-    if (message == NULL) exit(7);
+  int rc = decode_placements((const uint8_t *) message, len, board, placements);
+  stats_end(PHASE_EXCHANGE, begin);
+  return rc;
+}
 
-    if (strcmp(message, "000") == 0) {
-      return newboard;
-    }
+// Decode a placements message
+int decode_placements(const uint8_t * data, size_t len, board_t board, placements_t * placements) {
+  const uint8_t * end = data + len;
+  uint64_t cells = (uint64_t)board->width * board->height;
+  uint64_t count;
+  placements->count = 0;
+  int rc = 0;
+  if (len < 1 || *data++ != PLACEMENTS || !get_varint(&data, end, &count) || count > cells) {
+    rc = -1;
+  }
 
-    newboard[(int)(message[1])][(int)(message[2])].color = (int)(message[0]);
-    newboard[(int)(message[1])][(int)(message[2])].alive = true;
-    newboard[(int)(message[1])][(int)(message[2])].future = true;
+  for (uint64_t i = 0; rc == 0 && i < count; i++) {
+    uint64_t entry;
+    int color;
+    if (!get_varint(&data, end, &entry) || (entry >> 2) >= cells ||
+        ((color = entry & 3) != COLORLESS && color != RED && color != BLUE)) {
+      rc = -1;
+    } else {
+      record_placement(placements, (entry >> 2) / board->width, (entry >> 2) % board->width, color);
+    }
   }
+
+  return rc;
+}
+
+// Tell a player what size board we are playing on, and which color they play
+int send_dimensions(conn_t * conn, int width, int height, int color) {
+  char message[32];
+  snprintf(message, sizeof(message), "size %d %d %s", width, height, color == RED ? "red" : "blue");
+  return conn_send_message(conn, message);
+}
+
+// Learn the size of the board and our color from the server. Servers that don't say which color
+// we play have us play blue. Returns non-zero if the server sent something else.
+int recv_dimensions(conn_t * conn, int * width, int * height, int * color) {
+  char * message = conn_receive_message(conn);
+  if (message == NULL) return -1;
+
+  char name[8] = "blue";
+  int fields = sscanf(message, "size %d %d %7s", width, height, name);
+  *color = strcmp(name, "red") == 0 ? RED : BLUE;
+  int rc = fields >= 2 && valid_dimensions(*width, *height);
+  return rc ? 0 : -1;
 }
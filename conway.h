@@ -1,13 +1,25 @@
 #pragma once
 
 #include <stdbool.h>
-#include <ncurses.h>
+#include <stdint.h>
 
-#include "socket.h"
 #include "message.h"
 
-#define BOARD_SIZE 50
+#define BOARD_SIZE 50       // Default board width and height
+#define MAX_BOARD_SIZE 4096 // Largest width or height we will agree to
 #define LOSS_BONUS 15 // Bonus cells you get for losing
+#define MATCH_STEPS 75 // Generations in a round
+#define HISTORY_LENGTH 16 // Longest cycle a round will notice and cut short
+#define HASH_LENGTH 17 // Characters in a board hash written as text, with its terminator
+
+// Cells are packed one bit per cell into 64-bit words, row by row
+#define WORD_BITS 64
+#define PLANE_ALIGN 64 // Every plane starts on its own cache line
+#define TILE_ROWS 8    // A tile is one word wide and this many rows tall
+#define BOARD_POOL_SIZE 8 // Most boards kept around for reuse
+
+#define HEARTBEAT_INTERVAL 1 // Seconds the players go without sending before a heartbeat goes out
+#define PEER_TIMEOUT 30      // Seconds of silence after which a player gives up on the other
 
 enum Color {
   COLORLESS,
@@ -17,7 +29,6 @@ enum Color {
 
 typedef struct cell {
   bool alive;  // Whether there's a live cell here
-  bool future; // Whether the cell will be alive next turn
   int color;   // Which player owns the cell
   bool locked; // Whether a cell can be placed here by a player
 } cell_t;
@@ -28,31 +39,205 @@ typedef struct score {
   int diff;
 } score_t;
 
-typedef cell_t ** board_t;
+// A board is a set of bit planes, each `height` rows of `words` 64-bit words, sharing one
+// contiguous allocation. A cell is alive when its bit is set in either color plane, and never
+// in both.
+typedef struct board {
+  int width;
+  int height;
+  int words;              // Words per row
+  uint64_t * cells;       // The allocation holding every plane
+  uint64_t hash;          // Zobrist-style hash of the live cells and their colors
+  uint64_t locked_hash;   // The same, of the locked cells
+  uint64_t * red;         // Live red cells
+  uint64_t * blue;        // Live blue cells
+  uint64_t * locked;      // Cells the players may not remove
+  uint64_t * next_red;    // Scratch planes the next generation is written into
+  uint64_t * next_blue;
+  uint64_t * next_locked;
+  int tile_rows;          // Rows of tiles; each row of tiles is words tiles wide
+  uint8_t * active;       // Tiles that changed last generation, and must be looked at again
+  uint8_t * next_active;
+} * board_t;
+
+// The random key a live cell of a color contributes to the board hash. Keys are derived from the
+// cell rather than stored, so boards of any size can be hashed without a table.
+static inline uint64_t cell_key(int row, int column, int color) {
+  uint64_t key = (((uint64_t)row << 32 | (uint32_t)column) << 1 | (color == BLUE)) + 1;
+  key *= 0x9e3779b97f4a7c15ULL;
+  key ^= key >> 32;
+  key *= 0xd6e8feb86659fd93ULL;
+  key ^= key >> 32;
+  return key;
+}
+
+// The random key a locked cell contributes to the board's locked_hash. No row is negative, so
+// these never match a color's key.
+static inline uint64_t lock_key(int row, int column) {
+  return cell_key(-1 - row, column, RED);
+}
+
+// A small, fast xorshift random number generator. The state must not be zero.
+static inline uint64_t next_random(uint64_t * state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static inline int random_below(uint64_t * state, int n) {
+  return (int)(next_random(state) % (uint64_t)n);
+}
+
+bool outofbounds(board_t board, int row, int column);
+
+bool valid_dimensions(int width, int height);
+
+// Create a blank board. Returns NULL if the dimensions are invalid or memory runs out.
+board_t create_board(int width, int height);
 
-bool outofbounds(int row, int column);
+cell_t get_cell(board_t board, int row, int column);
 
-board_t create_board();
+// Set the contents of a cell. A color of COLORLESS clears the cell.
+void set_cell(board_t board, int row, int column, int color, bool locked);
 
-cell_t get_cell(board_t board, int row, int column);
+void clear_board(board_t board);
 
-void spawn(board_t board, int row, int column, int color);
+// Fill a board at random, the same way for the same seed: each cell is alive with the given
+// probability, and red or blue with even odds. For benchmarks and checks.
+void fill_board(board_t board, double density, uint64_t seed);
 
-void kill(board_t board, int row, int column);
+// Copy a board onto another with the same width and height
+void copy_board(board_t dest, board_t source);
 
-void update_cell(board_t board, int row, int column);
+// Bring a cell to life as the result of a birth, which locks it
+void spawn_cell(board_t board, int row, int column, int color);
+
+void kill_cell(board_t board, int row, int column);
+
+// Set how many threads update_board splits each generation across. The threads are started
+// once and reused. Returns the number of threads actually in use.
+int set_update_threads(int threads);
 
 void update_board(board_t board);
 
 void free_board(board_t board);
 
-score_t print_board(board_t board, WINDOW * w_board, WINDOW * w_status);
+// Boards given back with release_board are kept, up to BOARD_POOL_SIZE of them, and handed out
+// again by acquire_board, so code that goes through boards all the time doesn't allocate for
+// each one. acquire_board returns a blank board, or NULL as create_board would.
+board_t acquire_board(int width, int height);
+
+void release_board(board_t board);
+
+// Free the boards the pool is holding
+void drain_board_pool();
+
+// The rules of update_board as lookup tables, for engines that work a cell at a time. A cell's
+// state is its color, plus RULE_LOCKED if it is locked, and a rule entry takes it to its next
+// state with no branches: next = (state & (entry >> 4)) | (entry & 0x0f).
+#define RULE_LOCKED 4
+#define RULE_NEIGHBORHOODS (1 << 18)
+
+// The rule entry for a cell, given whether it is alive and how many of its neighbors are alive
+// and how many of those are red
+uint8_t rule_entry(bool alive, int neighbors, int reds);
+
+// The rule entry for every 3x3 neighborhood. A neighborhood is indexed by the colors of its
+// cells, two bits apiece, row by row from the top left, so the cell at (row, column) is at bit
+// 6 * row + 2 * column and the center is at bit 8. The table is built on first use.
+const uint8_t * rule_table();
+
+// Write board->hash as text. Players compare these to make sure they are in sync.
+void hash_string(board_t board, char buffer[HASH_LENGTH]);
+
+// A fingerprint of everything about a board that affects how it plays out: its live cells, their
+// colors, and which are locked. It is read from hashes kept up to date as cells change, so it
+// costs nothing to take, however big the board is.
+uint64_t board_fingerprint(board_t board);
+
+// Count the live cells of each color
+score_t count_board(board_t board);
+
+// The progress of a round. Once the board settles into a still life or a short cycle, the round
+// skips ahead: it only plays the few generations needed to reach the state it would be in after
+// MATCH_STEPS.
+typedef struct round {
+  int step;                         // Generations played so far
+  int end;                          // The generation the round will finish on
+  uint64_t history[HISTORY_LENGTH]; // Fingerprints of recent generations, indexed by step
+} round_t;
+
+void start_round(round_t * round, board_t board);
+
+// Play the next generation of a round. Returns false, without touching the board, once the round
+// is over.
+bool step_round(round_t * round, board_t board);
+
+// A cell a player placed during set_board, or took back if the color is COLORLESS
+typedef struct placement {
+  int row;
+  int column;
+  int color;
+} placement_t;
+
+typedef struct placements {
+  placement_t * cells;
+  int count;
+  int capacity;
+} placements_t;
+
+void record_placement(placements_t * placements, int row, int column, int color);
+
+// Apply the placements of the player with the given color to our board, which already has our
+// own. Both players start a round from the same board, so applying each other's placements leaves
+// them with the same board again. Where both placed a cell, neither gets it. Placements that
+// player could not have made are ignored.
+void merge_placements(board_t board, placements_t * ours, placements_t * theirs, int color);
+
+#define PLACEMENTS 'P' // First byte of a placements message
+
+// Exchange placements. recv_placements returns non-zero if the message was not valid
+// placements for this board.
+int send_placements(conn_t * conn, board_t board, placements_t * placements);
+
+int recv_placements(conn_t * conn, board_t board, placements_t * placements);
+
+// Encode placements as a message. Returns a buffer that must be freed, storing its length in *len,
+// or NULL if memory runs out.
+uint8_t * encode_placements(board_t board, placements_t * placements, size_t * len);
+
+// Decode a placements message that has already been received. Returns non-zero if it was not
+// valid placements for this board.
+int decode_placements(const uint8_t * data, size_t len, board_t board, placements_t * placements);
+
+// Write a number as a varint: seven bits per byte, low bits first, with the high bit set on every
+// byte but the last. Returns the number of bytes written, at most 10.
+size_t put_varint(uint8_t * out, uint64_t value);
+
+// Read a varint, advancing *in. Returns false if it runs past the end.
+bool get_varint(const uint8_t ** in, const uint8_t * end, uint64_t * value);
+
+// A snapshot is a board as a single message: a format byte, the width and height as varints, and
+// then either a bitmap of each color plane or a list of the live cells, whichever is smaller
+#define SNAPSHOT_BITMAP 'B'
+#define SNAPSHOT_LIST 'L'
+
+// Encode a board as a snapshot. Returns a buffer that must be freed, storing its length in *len,
+// or NULL if memory runs out.
+uint8_t * encode_board(board_t board, size_t * len);
+
+// Decode a snapshot into a board from the pool, to give back with release_board when done.
+// Returns NULL if the snapshot is malformed.
+board_t decode_board(const uint8_t * data, size_t len);
 
-// Return whether a the player wishes to continue placing
-int place_cell(int color, board_t board, WINDOW * w_board, WINDOW * w_status);
+void send_board(conn_t * conn, board_t board);
 
-void set_board(int count, int color, board_t board, WINDOW * w_board, WINDOW * w_status);
+// Receive a board, which comes from the pool as decode_board's do
+board_t recv_board(conn_t * conn, int width, int height);
 
-void send_board(int fd, board_t board);
+// Agree on the board dimensions, and the color a player plays, at the start of a game.
+// recv_dimensions returns non-zero if the server did not send valid dimensions.
+int send_dimensions(conn_t * conn, int width, int height, int color);
 
-board_t recv_board(int fd);
+int recv_dimensions(conn_t * conn, int * width, int * height, int * color);
@@ -1,4 +1,4 @@
-#include <ncurses.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include "conway.h"
 #include "socket.h"
@@ -28,7 +28,12 @@ int main() {
 
   printf("Found victim!\n");
 
-  send_message(client_socket,"swin");
+  // Get past the handshake, then declare victory
+  conn_t * client = conn_open(client_socket, NULL);
+  if (client == NULL) exit(-1);
+  send_dimensions(client, BOARD_SIZE, BOARD_SIZE, BLUE);
+  conn_send_message(client,"swin");
+  conn_close(client);
 
   printf("You won the set!\n");
   return 0;
@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashlife.h"
+
+// The states a single cell can be in. A live cell is its color, plus LOCKED if it was born rather
+// than placed. Everything off the edge of the board is WALL, which never changes and counts as
+// dead, so the bounded board behaves exactly as it does in update_board.
+#define LOCKED RULE_LOCKED
+#define WALL 8
+#define STATES 16
+
+#define MAX_LEVEL 63
+#define MAX_NODES (1 << 22) // Forget everything rather than grow past this many nodes
+#define CHUNK_NODES 4096
+
+typedef struct node {
+  struct node * nw;     // Quadrants, NULL for a single cell
+  struct node * ne;
+  struct node * sw;
+  struct node * se;
+  struct node * result; // The center of this node, result_step generations on
+  struct node * chain;  // Next node in the same hash bucket
+  uint64_t hash;
+  int level;            // The node is 2^level cells on a side
+  int result_step;      // Log2 of the generations result is for
+  int state;            // The state of a single cell
+} node_t;
+
+typedef struct chunk {
+  struct chunk * next;
+  node_t nodes[CHUNK_NODES];
+} chunk_t;
+
+struct hashlife {
+  node_t ** table;      // Every node, so that equal nodes are the same node
+  size_t buckets;
+  size_t count;
+  chunk_t * chunks;     // Where the nodes live
+  int used;             // Nodes used in the newest chunk
+  node_t * cells[STATES];
+  node_t * walls[MAX_LEVEL + 1];
+  node_t * empties[MAX_LEVEL + 1];
+  const uint8_t * rules; // The rule for every 3x3 neighborhood
+};
+
+// Mix the bits of a hash
+static uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Hand out a fresh node, or NULL if we are out of room
+static node_t * new_node(hashlife_t * life) {
+  if (life->count >= MAX_NODES) return NULL;
+  if (life->chunks == NULL || life->used == CHUNK_NODES) {
+    chunk_t * chunk = (chunk_t *) malloc(sizeof(chunk_t));
+    if (chunk == NULL) return NULL;
+    chunk->next = life->chunks;
+    life->chunks = chunk;
+    life->used = 0;
+  }
+  node_t * node = &life->chunks->nodes[life->used++];
+  memset(node, 0, sizeof(node_t));
+  node->result_step = -1;
+  life->count++;
+  return node;
+}
+
+// Double the hash table once it gets crowded
+static void grow_table(hashlife_t * life) {
+  size_t buckets = life->buckets * 2;
+  node_t ** table = (node_t **) calloc(buckets, sizeof(node_t *));
+  if (table == NULL) return;
+
+  for (size_t i = 0; i < life->buckets; i++) {
+    node_t * node = life->table[i];
+    while (node != NULL) {
+      node_t * next = node->chain;
+      size_t b = node->hash & (buckets - 1);
+      node->chain = table[b];
+      table[b] = node;
+      node = next;
+    }
+  }
+
+  free(life->table);
+  life->table = table;
+  life->buckets = buckets;
+}
+
+// Find the one node with these quadrants, creating it if needed
+static node_t * join(hashlife_t * life, node_t * nw, node_t * ne, node_t * sw, node_t * se) {
+  if (nw == NULL || ne == NULL || sw == NULL || se == NULL) return NULL;
+
+  uint64_t h = mix(nw->hash + 3 * mix(ne->hash + 5 * mix(sw->hash + 7 * se->hash)));
+  size_t b = h & (life->buckets - 1);
+  for (node_t * node = life->table[b]; node != NULL; node = node->chain) {
+    if (node->nw == nw && node->ne == ne && node->sw == sw && node->se == se) return node;
+  }
+
+  node_t * node = new_node(life);
+  if (node == NULL) return NULL;
+  node->nw = nw;
+  node->ne = ne;
+  node->sw = sw;
+  node->se = se;
+  node->hash = h;
+  node->level = nw->level + 1;
+  node->chain = life->table[b];
+  life->table[b] = node;
+
+  if (life->count > life->buckets) grow_table(life);
+  return node;
+}
+
+// A node of nothing but wall
+static node_t * wall(hashlife_t * life, int level) {
+  if (life->walls[level] == NULL) {
+    node_t * q = wall(life, level - 1);
+    life->walls[level] = join(life, q, q, q, q);
+  }
+  return life->walls[level];
+}
+
+// A node of nothing but dead cells
+static node_t * empty(hashlife_t * life, int level) {
+  if (life->empties[level] == NULL) {
+    node_t * q = empty(life, level - 1);
+    life->empties[level] = join(life, q, q, q, q);
+  }
+  return life->empties[level];
+}
+
+// Drop every node, keeping only the single cells
+static void reset(hashlife_t * life) {
+  while (life->chunks != NULL) {
+    chunk_t * next = life->chunks->next;
+    free(life->chunks);
+    life->chunks = next;
+  }
+  life->used = 0;
+  life->count = 0;
+  memset(life->table, 0, sizeof(node_t *) * life->buckets);
+  memset(life->walls, 0, sizeof(life->walls));
+  memset(life->empties, 0, sizeof(life->empties));
+
+  for (int state = 0; state < STATES; state++) {
+    node_t * cell = new_node(life);
+    cell->state = state;
+    cell->hash = mix(state + 1);
+    life->cells[state] = cell;
+  }
+  life->walls[0] = life->cells[WALL];
+  life->empties[0] = life->cells[COLORLESS];
+}
+
+// Create an engine
+hashlife_t * hashlife_create() {
+  hashlife_t * life = (hashlife_t *) calloc(1, sizeof(hashlife_t));
+  if (life == NULL) return NULL;
+
+  life->rules = rule_table();
+  life->buckets = 1 << 16;
+  life->table = (node_t **) calloc(life->buckets, sizeof(node_t *));
+  if (life->table == NULL) {
+    free(life);
+    return NULL;
+  }
+
+  reset(life);
+  return life;
+}
+
+// Destroy an engine
+void hashlife_free(hashlife_t * life) {
+  while (life->chunks != NULL) {
+    chunk_t * next = life->chunks->next;
+    free(life->chunks);
+    life->chunks = next;
+  }
+  free(life->table);
+  free(life);
+}
+
+// The next state of the cell at (row, column) of a 4x4 grid, by the rules of update_board. Each
+// row of the grid is packed two bits a cell, so the cell's neighborhood is a few shifts away.
+static inline int rule(const uint8_t * table, int grid[4][4], unsigned rows[4], int row,
+                       int column) {
+  int center = grid[row][column];
+  int shift = 2 * (column - 1);
+  unsigned index = (rows[row - 1] >> shift & 63) | (rows[row] >> shift & 63) << 6 |
+                   (rows[row + 1] >> shift & 63) << 12;
+  uint8_t entry = table[index];
+  int next = (center & (entry >> 4)) | (entry & 0x0f);
+  return center == WALL ? WALL : next;
+}
+
+// The center of a 4x4 node, one generation on
+static node_t * advance_leaf(hashlife_t * life, node_t * node) {
+  int grid[4][4];
+  node_t * quads[4] = {node->nw, node->ne, node->sw, node->se};
+  for (int q = 0; q < 4; q++) {
+    int row = (q / 2) * 2;
+    int column = (q % 2) * 2;
+    grid[row][column] = quads[q]->nw->state;
+    grid[row][column + 1] = quads[q]->ne->state;
+    grid[row + 1][column] = quads[q]->sw->state;
+    grid[row + 1][column + 1] = quads[q]->se->state;
+  }
+
+  // Walls and locks drop out of the packed rows, leaving just the colors
+  unsigned rows[4];
+  for (int row = 0; row < 4; row++) {
+    rows[row] = 0;
+    for (int column = 0; column < 4; column++) {
+      rows[row] |= (unsigned)(grid[row][column] & (RED | BLUE)) << (2 * column);
+    }
+  }
+
+  return join(life,
+              life->cells[rule(life->rules, grid, rows, 1, 1)],
+              life->cells[rule(life->rules, grid, rows, 1, 2)],
+              life->cells[rule(life->rules, grid, rows, 2, 1)],
+              life->cells[rule(life->rules, grid, rows, 2, 2)]);
+}
+
+// The center half of a node, as it is now
+static node_t * center(hashlife_t * life, node_t * node) {
+  return join(life, node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+}
+
+// The center half of a node, 2^step generations on. The step can be at most level - 2, which is
+// as far as anything outside the node can take to reach the center.
+static node_t * advance(hashlife_t * life, node_t * node, int step) {
+  if (node->result != NULL && node->result_step == step) return node->result;
+
+  node_t * result;
+  if (node->level == 2) {
+    result = advance_leaf(life, node);
+  } else {
+    // Nine overlapping nodes of half the size, covering the node
+    node_t * parts[3][3];
+    parts[0][0] = node->nw;
+    parts[0][1] = join(life, node->nw->ne, node->ne->nw, node->nw->se, node->ne->sw);
+    parts[0][2] = node->ne;
+    parts[1][0] = join(life, node->nw->sw, node->nw->se, node->sw->nw, node->sw->ne);
+    parts[1][1] = center(life, node);
+    parts[1][2] = join(life, node->ne->sw, node->ne->se, node->se->nw, node->se->ne);
+    parts[2][0] = node->sw;
+    parts[2][1] = join(life, node->sw->ne, node->se->nw, node->sw->se, node->se->sw);
+    parts[2][2] = node->se;
+
+    // A full step goes half way here and half way below. A shorter one does all its work below.
+    bool full = step == node->level - 2;
+    int inner = full ? step - 1 : step;
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        if (parts[r][c] == NULL) return NULL;
+        parts[r][c] = full ? advance(life, parts[r][c], inner) : center(life, parts[r][c]);
+        if (parts[r][c] == NULL) return NULL;
+      }
+    }
+
+    node_t * quads[2][2];
+    for (int r = 0; r < 2; r++) {
+      for (int c = 0; c < 2; c++) {
+        node_t * quad = join(life, parts[r][c], parts[r][c + 1], parts[r + 1][c], parts[r + 1][c + 1]);
+        if (quad == NULL) return NULL;
+        quads[r][c] = advance(life, quad, inner);
+      }
+    }
+    result = join(life, quads[0][0], quads[0][1], quads[1][0], quads[1][1]);
+  }
+
+  if (result != NULL) {
+    node->result = result;
+    node->result_step = step;
+  }
+  return result;
+}
+
+// Surround a node with wall, giving a node twice the size with the old one in its center
+static node_t * embed(hashlife_t * life, node_t * node) {
+  node_t * w = wall(life, node->level - 1);
+  return join(life,
+              join(life, w, w, w, node->nw),
+              join(life, w, w, node->ne, w),
+              join(life, w, node->sw, w, w),
+              join(life, node->se, w, w, w));
+}
+
+// Whether a square of the board has no live cells. The square must be on the board.
+static bool square_empty(board_t board, int x0, int y0, int size) {
+  for (int y = y0; y < y0 + size; y++) {
+    for (int x = x0; x < x0 + size; x = (x / WORD_BITS + 1) * WORD_BITS) {
+      size_t i = (size_t)y * board->words + x / WORD_BITS;
+      uint64_t mask = ~(uint64_t)0 << (x % WORD_BITS);
+      int end = x0 + size - (x / WORD_BITS) * WORD_BITS;
+      if (end < WORD_BITS) mask &= ((uint64_t)1 << end) - 1;
+      if ((board->red[i] | board->blue[i]) & mask) return false;
+    }
+  }
+  return true;
+}
+
+// Build the node of the given level whose top-left corner is at (x, y) on the board. Anything
+// off the board is wall.
+static node_t * build(hashlife_t * life, board_t board, int level, long x, long y) {
+  long size = 1L << level;
+  if (x >= board->width || y >= board->height || x + size <= 0 || y + size <= 0) {
+    return wall(life, level);
+  }
+
+  if (level == 0) {
+    cell_t cell = get_cell(board, y, x);
+    if (!cell.alive) return life->cells[COLORLESS];
+    return life->cells[cell.color | (cell.locked ? LOCKED : 0)];
+  }
+
+  bool inside = x >= 0 && y >= 0 && x + size <= board->width && y + size <= board->height;
+  if (inside && square_empty(board, x, y, size)) return empty(life, level);
+
+  long half = size / 2;
+  return join(life,
+              build(life, board, level - 1, x, y),
+              build(life, board, level - 1, x + half, y),
+              build(life, board, level - 1, x, y + half),
+              build(life, board, level - 1, x + half, y + half));
+}
+
+// Write the live cells of a node whose top-left corner is at (x, y) on the board
+static void extract(hashlife_t * life, board_t board, node_t * node, long x, long y) {
+  long size = 1L << node->level;
+  if (x >= board->width || y >= board->height || x + size <= 0 || y + size <= 0) return;
+  if (node == life->empties[node->level] || node == life->walls[node->level]) return;
+
+  if (node->level == 0) {
+    set_cell(board, y, x, node->state & (RED | BLUE), (node->state & LOCKED) != 0);
+    return;
+  }
+
+  long half = size / 2;
+  extract(life, board, node->nw, x, y);
+  extract(life, board, node->ne, x + half, y);
+  extract(life, board, node->sw, x, y + half);
+  extract(life, board, node->se, x + half, y + half);
+}
+
+// Advance a board any number of generations
+int hashlife_run(hashlife_t * life, board_t board, uint64_t generations) {
+  if (life->count > MAX_NODES / 2) reset(life);
+
+  // Start from the smallest node with the board in its center half. The board sits at offset
+  // from the node's corner.
+  int level = 3;
+  while ((1L << (level - 1)) < board->width || (1L << (level - 1)) < board->height) level++;
+  long offset = 1L << (level - 2);
+  node_t * root = build(life, board, level, -offset, -offset);
+
+  for (int step = 0; root != NULL && generations >> step; step++) {
+    if (!((generations >> step) & 1)) continue;
+    if (step + 2 > MAX_LEVEL) {
+      root = NULL;
+      break;
+    }
+
+    // Grow until the node is big enough to take this step in one go
+    while (root != NULL && root->level < step + 2) {
+      offset += 1L << (root->level - 1);
+      root = embed(life, root);
+    }
+    if (root == NULL) break;
+
+    node_t * result = advance(life, root, step);
+    if (result == NULL) {
+      root = NULL;
+      break;
+    }
+
+    // The result is the center of the old root, so put it back in the center of a new one
+    root = embed(life, result);
+  }
+
+  if (root == NULL) {
+    reset(life);
+    return -1;
+  }
+
+  clear_board(board);
+  extract(life, board, root, -offset, -offset);
+  return 0;
+}
+
+// Advance a board 2^k generations
+int hashlife_advance(hashlife_t * life, board_t board, int k) {
+  if (k < 0 || k > MAX_LEVEL - 2) return -1;
+  return hashlife_run(life, board, (uint64_t)1 << k);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "conway.h"
+
+// A Hashlife engine: the board is held as a quadtree of canonical nodes, and the future of every
+// node is remembered, so repeated structure in space and time is only ever simulated once. It
+// keeps its memory between calls, so advancing similar boards again is cheap.
+typedef struct hashlife hashlife_t;
+
+// Create an engine. Returns NULL if memory runs out.
+hashlife_t * hashlife_create();
+
+// Destroy an engine and everything it remembers
+void hashlife_free(hashlife_t * life);
+
+// Advance a board 2^k generations in place, with exactly the result of calling update_board that
+// many times. Returns non-zero if memory runs out, in which case the board is unchanged.
+int hashlife_advance(hashlife_t * life, board_t board, int k);
+
+// Advance a board any number of generations in place. Returns non-zero if memory runs out, in
+// which case the board is unchanged.
+int hashlife_run(hashlife_t * life, board_t board, uint64_t generations);
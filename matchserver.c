@@ -0,0 +1,601 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "conway.h"
+#include "record.h"
+#include "socket.h"
+#include "stats.h"
+
+/*
+ * Match Server Program
+ *
+ * Hosts any number of games at once, with no terminal of its own. Players connect with the
+ * ordinary client and are paired off as they arrive: the first of each pair plays red and the
+ * second plays blue. The server keeps the real board for every game, plays each round on a pool
+ * of simulation workers, and holds both players' checkpoints up against it.
+ */
+
+#define MATCHES 5      // Decisive matches in a set
+#define MAX_EVENTS 64  // Events handled per wait
+#define MAX_BACKLOG (2 * (size_t)MAX_BYTES_LENGTH) // Unread bytes we will hold for a player
+
+// What a game is waiting on its players for
+enum stage {
+  SETTING,  // Their placements
+  READYING, // Word that they have the same board we do
+  PLAYING,  // Their checkpoints through the round
+  RESULTS   // Word that they have seen the result
+};
+
+typedef struct game game_t;
+
+typedef struct player {
+  conn_t * conn;
+  game_t * game;            // NULL until the player has an opponent
+  int color;
+  int bonus;                // Extra cells for the matches this player lost
+  int wins;
+  placements_t placements;  // What the player placed this match
+  bool waiting;             // Whether the game still needs to hear from this player this stage
+  bool writing;             // Whether we are watching for the socket to take more output
+  bool closed;
+  struct player * next;     // In the list of players to free
+} player_t;
+
+struct game {
+  int id;
+  player_t * players[2];    // Red, then blue
+  board_t board;
+  enum stage stage;
+  int matches;              // Decisive matches left to play
+
+  // The round, which a simulation worker plays out before we check anyone against it
+  round_t round;
+  bool simulated;
+  score_t score;
+  char hashes[MATCH_STEPS + 1][HASH_LENGTH];
+
+  recording_t * recording;  // The game's log, if we are keeping them
+  int winner;               // The color that won the set, once it is over
+
+  bool over;                // The game has ended, but a worker may still have it
+  game_t * next;            // In the simulation queue, or the list of games to free
+};
+
+// Simulation workers take games from a queue and hand them back, waking the event loop
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  game_t * queue;
+  game_t * tail;
+  game_t * finished;
+  int eventfd;
+} sim = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+static int epoll_fd;
+static int width = BOARD_SIZE;
+static int height = BOARD_SIZE;
+static int checkpoint = 25;
+static char * log_directory = NULL;
+static long started; // When the server started, to tell its logs apart from another run's
+
+// The player who has connected but has no opponent yet, if any
+static player_t * waiting;
+
+// Players and games that have ended, freed once nothing in the current batch of events can
+// still refer to them
+static player_t * dead_players;
+static game_t * dead_games;
+
+// Tags to tell the listening socket and the workers' eventfd apart from players
+static int listener_tag;
+static int wakeup_tag;
+
+// Play a whole round, remembering the hash at each step
+static void simulate(game_t * game) {
+  start_round(&game->round,game->board);
+  hash_string(game->board,game->hashes[0]);
+  while (step_round(&game->round,game->board)) {
+    hash_string(game->board,game->hashes[game->round.step]);
+  }
+  game->score = count_board(game->board);
+}
+
+// A simulation worker
+static void * sim_worker(void * arg) {
+  pthread_mutex_lock(&sim.lock);
+  while (true) {
+    while (sim.queue == NULL) pthread_cond_wait(&sim.wake,&sim.lock);
+    game_t * game = sim.queue;
+    sim.queue = game->next;
+    if (sim.queue == NULL) sim.tail = NULL;
+    pthread_mutex_unlock(&sim.lock);
+
+    simulate(game);
+
+    pthread_mutex_lock(&sim.lock);
+    game->next = sim.finished;
+    sim.finished = game;
+    uint64_t one = 1;
+    if (write(sim.eventfd,&one,sizeof(one)) < 0) perror("eventfd write");
+  }
+  return NULL;
+}
+
+// Hand a game to the simulation workers
+static void queue_simulation(game_t * game) {
+  game->simulated = false;
+  game->next = NULL;
+  pthread_mutex_lock(&sim.lock);
+  if (sim.tail) {
+    sim.tail->next = game;
+  } else {
+    sim.queue = game;
+  }
+  sim.tail = game;
+  pthread_cond_signal(&sim.wake);
+  pthread_mutex_unlock(&sim.lock);
+}
+
+// Close a player's connection. The player itself is freed after this batch of events.
+static void drop_player(player_t * player) {
+  if (player->closed) return;
+  player->closed = true;
+  conn_close(player->conn);
+  if (player == waiting) waiting = NULL;
+  player->next = dead_players;
+  dead_players = player;
+}
+
+// End a game, disconnecting both players
+static void end_game(game_t * game, const char * why) {
+  if (game->over) return;
+  game->over = true;
+  printf("Game %d: %s\n",game->id,why);
+  record_close(game->recording,game->winner);
+  game->recording = NULL;
+
+  for (int i = 0; i < 2; i++) drop_player(game->players[i]);
+
+  // A worker still playing the round will hand the game back, and we free it then
+  if (game->stage != PLAYING || game->simulated) {
+    game->next = dead_games;
+    dead_games = game;
+  }
+}
+
+// Write out whatever a player has queued, watching for room in the socket if it doesn't all fit
+static void flush_player(player_t * player) {
+  if (player->closed) return;
+  if (conn_flush(player->conn)) {
+    if (player->game) {
+      end_game(player->game,"connection lost");
+    } else {
+      drop_player(player);
+    }
+    return;
+  }
+
+  bool writing = conn_pending(player->conn) > 0;
+  if (writing != player->writing) {
+    struct epoll_event event = {.events = EPOLLIN | (writing ? EPOLLOUT : 0), .data.ptr = player};
+    epoll_ctl(epoll_fd,EPOLL_CTL_MOD,player->conn->fd,&event);
+    player->writing = writing;
+  }
+}
+
+// Send both players of a game the same message
+static void send_both(game_t * game, const char * message) {
+  for (int i = 0; i < 2; i++) conn_send_message(game->players[i]->conn,message);
+}
+
+// Start a match: both players set their boards
+static void start_match(game_t * game) {
+  game->stage = SETTING;
+  for (int i = 0; i < 2; i++) {
+    game->players[i]->placements.count = 0;
+    game->players[i]->waiting = true;
+  }
+  send_both(game,"setboard");
+}
+
+// Check that a player only placed their own cells on empty squares, took back only their own
+// unlocked cells, and used no more cells than they have
+static bool valid_placements(board_t board, player_t * player) {
+  int used = 0;
+  for (int i = 0; i < player->placements.count; i++) {
+    placement_t * p = &player->placements.cells[i];
+    cell_t cell = get_cell(board,p->row,p->column);
+    if (p->color == player->color && !cell.alive) {
+      used++;
+    } else if (p->color == COLORLESS && cell.alive && cell.color == player->color &&
+               !cell.locked) {
+      used--;
+    } else {
+      return false;
+    }
+  }
+  return used <= 10 + player->bonus;
+}
+
+// Both players have placed their cells. Merge them the same way the players will, then send each
+// the other's placements and the hash they should end up with.
+static void merge_match(game_t * game) {
+  player_t * red = game->players[0];
+  player_t * blue = game->players[1];
+  apply_placements(game->board,&red->placements,&blue->placements);
+
+  char hash[HASH_LENGTH];
+  hash_string(game->board,hash);
+  for (int i = 0; i < 2; i++) {
+    player_t * other = game->players[1 - i];
+    if (send_placements(game->players[i]->conn,game->board,&other->placements) ||
+        conn_send_message(game->players[i]->conn,hash)) {
+      end_game(game,"connection lost");
+      return;
+    }
+    game->players[i]->waiting = true;
+  }
+  game->stage = READYING;
+}
+
+// Both players have finished the round. Tell each how they did.
+static void score_match(game_t * game) {
+  player_t * red = game->players[0];
+  player_t * blue = game->players[1];
+
+  // Log the round. If that stops working, give up on the log rather than the game.
+  if (game->recording != NULL &&
+      record_round(game->recording,game->board,&red->placements,&blue->placements,
+                   game->round.step,game->board->hash)) {
+    record_close(game->recording,COLORLESS);
+    game->recording = NULL;
+  }
+
+  if (game->score.diff > 0) {
+    red->wins++;
+    blue->bonus += LOSS_BONUS;
+    game->matches--;
+    conn_send_message(red->conn,"cwin");
+    conn_send_message(blue->conn,"swin");
+  } else if (game->score.diff < 0) {
+    blue->wins++;
+    red->bonus += LOSS_BONUS;
+    game->matches--;
+    conn_send_message(red->conn,"swin");
+    conn_send_message(blue->conn,"cwin");
+  } else {
+    // Ties are replayed
+    send_both(game,"tie");
+  }
+
+  game->stage = RESULTS;
+  red->waiting = true;
+  blue->waiting = true;
+}
+
+// Handle one message from a player. Returns false if the game ended.
+static bool handle_message(game_t * game, player_t * player, char * message, size_t len) {
+  int step;
+  char hash[HASH_LENGTH];
+  bool done;
+
+  switch (game->stage) {
+  case SETTING:
+    if (decode_placements((uint8_t *) message,len,game->board,&player->placements) ||
+        !valid_placements(game->board,player)) {
+      end_game(game,"invalid placements");
+      return false;
+    }
+    break;
+  case READYING:
+  case RESULTS:
+    if (strcmp(message,"desynced") == 0) {
+      end_game(game,"desynced");
+      return false;
+    } else if (strcmp(message,"ready") != 0) {
+      end_game(game,"unexpected message");
+      return false;
+    }
+    break;
+  case PLAYING:
+    // The same checks the two player server makes of its client
+    done = strncmp(message,"done ",5) == 0;
+    if ((!done && strncmp(message,"check ",6) != 0) ||
+        sscanf(message + 5,"%d %16s",&step,hash) != 2 ||
+        step < 1 || step > game->round.step || (done && step != game->round.step) ||
+        strcmp(hash,game->hashes[step]) != 0) {
+      send_both(game,"desynced");
+      end_game(game,"desynced");
+      return false;
+    }
+    if (!done) return true;
+    break;
+  }
+  player->waiting = false;
+
+  // Move on once both players are through this stage
+  if (game->players[0]->waiting || game->players[1]->waiting) return true;
+  switch (game->stage) {
+  case SETTING:
+    merge_match(game);
+    break;
+  case READYING: {
+    // Both players play the round on their own while a worker plays it for us
+    game->stage = PLAYING;
+    game->players[0]->waiting = true;
+    game->players[1]->waiting = true;
+    char run[32];
+    snprintf(run,sizeof(run),"run %d",checkpoint);
+    send_both(game,run);
+    queue_simulation(game);
+    break;
+  }
+  case PLAYING:
+    score_match(game);
+    break;
+  case RESULTS:
+    if (game->matches > 0) {
+      start_match(game);
+    } else {
+      // Red takes the set if it comes out even, as the server does in a two player game
+      bool red_won = game->players[0]->wins >= game->players[1]->wins;
+      game->winner = red_won ? RED : BLUE;
+      conn_send_message(game->players[0]->conn,red_won ? "cwin" : "swin");
+      conn_send_message(game->players[1]->conn,red_won ? "swin" : "cwin");
+      end_game(game,red_won ? "red won the set" : "blue won the set");
+      return false;
+    }
+    break;
+  }
+  return !game->over;
+}
+
+// Handle every message the players of a game have sent that the game is ready for
+static void advance_game(game_t * game) {
+  bool progress = true;
+  while (progress && !game->over) {
+    progress = false;
+
+    // Checkpoints wait until we have played the round ourselves
+    if (game->stage == PLAYING && !game->simulated) break;
+
+    for (int i = 0; i < 2 && !game->over; i++) {
+      player_t * player = game->players[i];
+      if (!player->waiting) continue;
+
+      size_t len;
+      size_t max = game->stage == SETTING ? MAX_BYTES_LENGTH : MAX_MESSAGE_LENGTH;
+      char * message = conn_next(player->conn,&len,max);
+      if (message == NULL) {
+        if (player->conn->failed) end_game(game,"message too long");
+        continue;
+      }
+      if (handle_message(game,player,message,len)) progress = true;
+    }
+  }
+
+  for (int i = 0; i < 2; i++) flush_player(game->players[i]);
+}
+
+// Pair a new player with the one waiting for an opponent, if there is one
+static void pair_player(player_t * player) {
+  static int games = 0;
+
+  if (waiting == NULL) {
+    waiting = player;
+    return;
+  }
+
+  game_t * game = (game_t *) calloc(1,sizeof(game_t));
+  board_t board = acquire_board(width,height);
+  if (game == NULL || board == NULL) exit(-1);
+  game->id = ++games;
+  game->board = board;
+  game->matches = MATCHES;
+  game->players[0] = waiting;
+  game->players[1] = player;
+  waiting = NULL;
+
+  for (int i = 0; i < 2; i++) {
+    game->players[i]->game = game;
+    game->players[i]->color = i == 0 ? RED : BLUE;
+    send_dimensions(game->players[i]->conn,width,height,game->players[i]->color);
+  }
+  if (log_directory != NULL) {
+    char path[4096];
+    snprintf(path,sizeof(path),"%s/game-%ld-%d.log",log_directory,started,game->id);
+    game->recording = record_open(path,width,height);
+    if (game->recording == NULL) perror(path);
+  }
+  printf("Game %d: started\n",game->id);
+  start_match(game);
+  advance_game(game);
+}
+
+// Accept every player waiting to connect
+static void accept_players(int server_socket) {
+  int fd;
+  while ((fd = server_socket_accept(server_socket)) != -1) {
+    conn_options_t options = CONN_DEFAULTS;
+    options.nonblocking = true;
+    player_t * player = (player_t *) calloc(1,sizeof(player_t));
+    if (player == NULL || (player->conn = conn_open(fd,&options)) == NULL) exit(-1);
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = player};
+    epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&event);
+    pair_player(player);
+  }
+}
+
+// A player's socket has something for us
+static void player_event(player_t * player, uint32_t events) {
+  if (player->closed) return;
+
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    conn_t * conn = player->conn;
+    if (conn_fill(conn) || conn->in_end - conn->in_start > MAX_BACKLOG) {
+      if (player->game) {
+        end_game(player->game,"connection lost");
+      } else {
+        drop_player(player);
+      }
+      return;
+    }
+  }
+
+  if (player->game) {
+    advance_game(player->game);
+  } else {
+    flush_player(player);
+  }
+}
+
+// Pick up the games the workers have finished simulating
+static void collect_simulations() {
+  uint64_t count;
+  if (read(sim.eventfd,&count,sizeof(count)) < 0) return;
+
+  pthread_mutex_lock(&sim.lock);
+  game_t * game = sim.finished;
+  sim.finished = NULL;
+  pthread_mutex_unlock(&sim.lock);
+
+  while (game) {
+    game_t * next = game->next;
+    game->simulated = true;
+    if (game->over) {
+      game->next = dead_games;
+      dead_games = game;
+    } else {
+      advance_game(game);
+    }
+    game = next;
+  }
+}
+
+// Free everything that ended during the last batch of events
+static void free_dead() {
+  while (dead_players) {
+    player_t * player = dead_players;
+    dead_players = player->next;
+    free(player->placements.cells);
+    free(player);
+  }
+  while (dead_games) {
+    game_t * game = dead_games;
+    dead_games = game->next;
+    release_board(game->board);
+    free(game);
+  }
+}
+
+int main(int argc, char ** argv) {
+  unsigned short port = 0;
+  int workers = sysconf(_SC_NPROCESSORS_ONLN);
+  char * stats_path = NULL;
+
+  // Read command line options
+  int opt;
+  while ((opt = getopt(argc, argv, "p:j:t:w:h:c:l:s:")) != -1) {
+    switch (opt) {
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'j':
+      // Simulation workers, each playing one game's round at a time
+      workers = atoi(optarg);
+      break;
+    case 't':
+      // Threads used to update a board. Only one board uses them at a time.
+      set_update_threads(atoi(optarg));
+      break;
+    case 'w':
+      width = atoi(optarg);
+      break;
+    case 'h':
+      height = atoi(optarg);
+      break;
+    case 'c':
+      checkpoint = atoi(optarg);
+      break;
+    case 'l':
+      // A directory to write a log of each game to
+      log_directory = optarg;
+      break;
+    case 's':
+      // Where to write timings, whenever we get SIGUSR1
+      stats_path = optarg;
+      break;
+    default:
+      width = 0;
+    }
+  }
+
+  if (!valid_dimensions(width, height) || checkpoint < 1 || workers < 1) {
+    fprintf(stderr, "Usage: %s [-p port] [-j workers] [-t threads] [-w width] [-h height] "
+            "[-c checkpoint] [-l log directory] [-s stats]\n", argv[0]);
+    fprintf(stderr, "Width and height must be between 1 and %d\n", MAX_BOARD_SIZE);
+    exit(EXIT_FAILURE);
+  }
+
+  if (stats_path != NULL && stats_open(stats_path)) {
+    perror("Couldn't start collecting stats");
+    exit(EXIT_FAILURE);
+  }
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  started = time(NULL);
+
+  int server_socket = server_socket_open(&port);
+  if (server_socket == -1) exit(-1);
+  if (listen(server_socket, SOMAXCONN)) {
+    perror("listen failed");
+    exit(EXIT_FAILURE);
+  }
+  fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+  printf("Match server listening on port %u\n",port);
+
+  // Start the simulation workers
+  sim.eventfd = eventfd(0, EFD_NONBLOCK);
+  if (sim.eventfd == -1) exit(-1);
+  for (int i = 0; i < workers; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, sim_worker, NULL)) exit(-1);
+    pthread_detach(thread);
+  }
+
+  // Watch for new players and finished simulations
+  epoll_fd = epoll_create1(0);
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = &listener_tag};
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event);
+  event.data.ptr = &wakeup_tag;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sim.eventfd, &event);
+
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait failed");
+      exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == &listener_tag) {
+        accept_players(server_socket);
+      } else if (events[i].data.ptr == &wakeup_tag) {
+        collect_simulations();
+      } else {
+        player_event((player_t *) events[i].data.ptr, events[i].events);
+      }
+    }
+    free_dead();
+  }
+}
@@ -1,12 +1,28 @@
 #include "message.h"
+#include "stats.h"
+#include "transport.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 // Send a across a socket with a header that includes the message length.
 int send_message(int fd, char* message) {
   // If the message is NULL, set errno to EINVAL and return an error
@@ -38,8 +54,8 @@ int send_message(int fd, char* message) {
   return 0;
 }
 
-// Receive a message from a socket and return the message string (which must be freed later)
-char* receive_message(int fd) {
+// Receive a message of up to max bytes from a socket
+static char* receive_limited(int fd, size_t max, size_t* lenp) {
   // First try to read in the message length
   size_t len;
   if (read(fd, &len, sizeof(size_t)) != sizeof(size_t)) {
@@ -48,13 +64,14 @@ char* receive_message(int fd) {
   }
 
   // Now make sure the message length is reasonable
-  if (len > MAX_MESSAGE_LENGTH) {
+  if (len > max) {
     errno = EINVAL;
     return NULL;
   }
 
   // Allocate space for the message and a null terminator
   char* result = malloc(len + 1);
+  if (result == NULL) return NULL;
 
   // Try to read the message. Loop until the entire message has been read.
   size_t bytes_read = 0;
@@ -75,5 +92,398 @@ char* receive_message(int fd) {
   // Add a null terminator to the message
   result[len] = '\0';
 
+  if (lenp != NULL) *lenp = len;
   return result;
 }
+
+// Receive a message from a socket and return the message string (which must be freed later)
+char* receive_message(int fd) {
+  return receive_limited(fd, MAX_MESSAGE_LENGTH, NULL);
+}
+
+// Make sure a buffer can hold at least size bytes. Returns non-zero if memory runs out.
+static int reserve(char** buffer, size_t* capacity, size_t size) {
+  if (size <= *capacity) return 0;
+
+  size_t grown = *capacity ? *capacity : CONN_BUFFER_SIZE;
+  while (grown < size) grown *= 2;
+  char* bigger = realloc(*buffer, grown);
+  if (bigger == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  *buffer = bigger;
+  *capacity = grown;
+  return 0;
+}
+
+// Wrap a connected socket in a buffered connection
+conn_t* conn_open(int fd, const conn_options_t* options) {
+  conn_options_t defaults = CONN_DEFAULTS;
+  if (options == NULL) options = &defaults;
+
+  // Headers and small messages go out as soon as they are flushed, rather than waiting on Nagle
+  int on = options->nodelay ? 1 : 0;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (options->send_buffer > 0) {
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options->send_buffer, sizeof(int));
+  }
+  if (options->receive_buffer > 0) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options->receive_buffer, sizeof(int));
+  }
+  if (options->nonblocking) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  // A blocking read gives up after a while, so a receive can send heartbeats and notice a timeout
+  // without the extra system call of polling first
+  double wake = options->heartbeat;
+  if (options->timeout > 0 && (wake <= 0 || options->timeout < wake)) wake = options->timeout;
+  if (wake > 0 && !options->nonblocking) {
+    struct timeval tv = {.tv_sec = (time_t)wake, .tv_usec = (long)((wake - (time_t)wake) * 1e6)};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+
+  conn_t* conn = calloc(1, sizeof(conn_t));
+  if (conn == NULL) return NULL;
+  conn->fd = fd;
+  conn->nonblocking = options->nonblocking;
+  conn->transport = &socket_transport;
+  conn->heartbeat = options->heartbeat;
+  conn->timeout = options->timeout;
+  conn->wake = options->nonblocking ? 0 : wake;
+  conn->last_heard = now();
+
+  // The first wait sends a heartbeat straight away, so the other side knows to expect them
+  conn->last_sent = 0;
+  return conn;
+}
+
+// Wrap a socket, moving the connection onto shared memory if there is a link to it
+static conn_t* conn_open_link(int fd, const conn_options_t* options, void* link) {
+  conn_t* conn = conn_open(fd, options);
+  if (conn == NULL) {
+    transport_release(link);
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (link != NULL) {
+    conn->transport = &shared_transport;
+    conn->link = link;
+  }
+  return conn;
+}
+
+// Offer the other side a transport, then wrap the socket
+conn_t* conn_open_local(int fd, const conn_options_t* options, bool shared) {
+  void* link;
+  if (transport_offer(fd, shared, &link)) return NULL;
+  return conn_open_link(fd, options, link);
+}
+
+// Take the transport the other side offered, then wrap the socket
+conn_t* conn_join_local(int fd, const conn_options_t* options) {
+  void* link;
+  if (transport_accept(fd, &link)) return NULL;
+  return conn_open_link(fd, options, link);
+}
+
+// Flush anything still queued, then close the socket and free the connection. A non-blocking
+// connection only gets out what the socket will take right away.
+void conn_close(conn_t* conn) {
+  if (conn == NULL) return;
+  conn_flush(conn);
+  stats_connection_closed(conn);
+  conn->transport->close(conn);
+  free(conn->out);
+  free(conn->in);
+  free(conn);
+}
+
+// Write as much of the queue as the socket will take, followed by an optional extra frame that
+// has not been copied into the queue. Whatever is left over is queued.
+static int conn_write(conn_t* conn, const void* data, size_t len) {
+  size_t header = len;
+  struct iovec iov[3] = {
+      {.iov_base = conn->out + conn->out_start, .iov_len = conn->out_end - conn->out_start},
+      {.iov_base = &header, .iov_len = data ? sizeof(size_t) : 0},
+      {.iov_base = (void*)data, .iov_len = data ? len : 0}
+  };
+  struct iovec* next = iov;
+  int count = 3;
+
+  while (count > 0) {
+    // Skip anything empty or already written
+    if (next->iov_len == 0) {
+      next++;
+      count--;
+      continue;
+    }
+
+    ssize_t rc = conn->transport->send(conn, next, count);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && conn->nonblocking) break;
+    if (rc <= 0) return -1;
+
+    conn->bytes_sent += rc;
+    conn->writes++;
+    if (conn->heartbeat > 0) conn->last_sent = now();
+    while (count > 0 && (size_t)rc >= next->iov_len) {
+      if (next == iov) conn->out_start = conn->out_end;
+      rc -= next->iov_len;
+      next->iov_len = 0;
+      next++;
+      count--;
+    }
+    if (count > 0) {
+      if (next == iov) conn->out_start += rc;
+      next->iov_base = (char*)next->iov_base + rc;
+      next->iov_len -= rc;
+    }
+  }
+
+  // Keep the unwritten queue at the front of the buffer, and append what is left of the frame
+  size_t queued = conn->out_end - conn->out_start;
+  if (conn->out_start > 0) {
+    memmove(conn->out, conn->out + conn->out_start, queued);
+    conn->out_start = 0;
+    conn->out_end = queued;
+  }
+  size_t rest = iov[1].iov_len + iov[2].iov_len;
+  if (rest > 0) {
+    if (reserve(&conn->out, &conn->out_capacity, queued + rest)) return -1;
+    memcpy(conn->out + conn->out_end, iov[1].iov_base, iov[1].iov_len);
+    conn->out_end += iov[1].iov_len;
+    memcpy(conn->out + conn->out_end, iov[2].iov_base, iov[2].iov_len);
+    conn->out_end += iov[2].iov_len;
+  }
+  return 0;
+}
+
+// Queue a message of arbitrary bytes
+int conn_send(conn_t* conn, const void* data, size_t len) {
+  conn->messages_sent++;
+
+  // Large messages are written straight from the caller's buffer along with the queue
+  if (len >= CONN_BUFFER_SIZE) return conn_write(conn, data, len);
+
+  size_t queued = conn->out_end;
+  if (reserve(&conn->out, &conn->out_capacity, queued + sizeof(size_t) + len)) return -1;
+  memcpy(conn->out + queued, &len, sizeof(size_t));
+  memcpy(conn->out + queued + sizeof(size_t), data, len);
+  conn->out_end = queued + sizeof(size_t) + len;
+
+  // Don't let the queue grow without bound between flushes
+  if (conn->out_end - conn->out_start >= CONN_BUFFER_SIZE) return conn_flush(conn);
+  return 0;
+}
+
+// Queue a message string
+int conn_send_message(conn_t* conn, const char* message) {
+  if (message == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  return conn_send(conn, message, strlen(message));
+}
+
+// Write out every queued message
+int conn_flush(conn_t* conn) {
+  if (conn->out_end == conn->out_start) return 0;
+  return conn_write(conn, NULL, 0);
+}
+
+// The number of bytes queued but not yet written
+size_t conn_pending(conn_t* conn) {
+  return conn->out_end - conn->out_start;
+}
+
+// Put back the byte the last message's terminator replaced
+static void conn_restore(conn_t* conn) {
+  if (conn->terminated) {
+    conn->in[conn->in_start] = conn->saved;
+    conn->terminated = false;
+  }
+}
+
+// Read whatever the socket has for us, in as few reads as possible
+int conn_fill(conn_t* conn) {
+  conn_restore(conn);
+
+  // Make room at the end of the buffer, moving unread bytes to the front if that helps
+  if (conn->in_start > 0 && conn->in_start == conn->in_end) {
+    conn->in_start = conn->in_end = 0;
+  } else if (conn->in_start > conn->in_capacity / 2) {
+    memmove(conn->in, conn->in + conn->in_start, conn->in_end - conn->in_start);
+    conn->in_end -= conn->in_start;
+    conn->in_start = 0;
+  }
+  if (reserve(&conn->in, &conn->in_capacity, conn->in_end + CONN_BUFFER_SIZE / 2)) return -1;
+
+  while (true) {
+    ssize_t rc = conn->transport->receive(conn, conn->in + conn->in_end,
+                                          conn->in_capacity - conn->in_end);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+        (conn->nonblocking || conn->heartbeat > 0 || conn->timeout > 0)) {
+      return 0;
+    }
+    if (rc <= 0) return -1;
+
+    conn->bytes_received += rc;
+    conn->reads++;
+    conn->in_end += rc;
+    if (conn->heartbeat > 0 || conn->timeout > 0) conn->last_heard = now();
+    return 0;
+  }
+}
+
+// Return the next complete message already in the buffer
+char* conn_next(conn_t* conn, size_t* len, size_t max) {
+  conn_restore(conn);
+
+  // Skip over heartbeats
+  size_t available = conn->in_end - conn->in_start;
+  size_t size;
+  while (true) {
+    if (available < sizeof(size_t)) return NULL;
+    memcpy(&size, conn->in + conn->in_start, sizeof(size_t));
+    if (size > 0) break;
+    conn->heartbeats_heard = true;
+    conn->in_start += sizeof(size_t);
+    available -= sizeof(size_t);
+  }
+  if (size > max) {
+    conn->failed = true;
+    errno = EINVAL;
+    return NULL;
+  }
+
+  // Wait for the rest of the message, making sure there will be room for it and a terminator
+  if (available < sizeof(size_t) + size) {
+    if (conn->in_start > 0) {
+      memmove(conn->in, conn->in + conn->in_start, available);
+      conn->in_start = 0;
+      conn->in_end = available;
+    }
+    if (reserve(&conn->in, &conn->in_capacity, sizeof(size_t) + size + 1)) conn->failed = true;
+    return NULL;
+  }
+
+  // Null terminate the message in place, remembering what was there
+  conn->in_start += sizeof(size_t) + size;
+  if (reserve(&conn->in, &conn->in_capacity, conn->in_start + 1)) {
+    conn->failed = true;
+    return NULL;
+  }
+  char* message = conn->in + conn->in_start - size;
+  conn->saved = conn->in[conn->in_start];
+  conn->in[conn->in_start] = '\0';
+  conn->terminated = true;
+  conn->messages_received++;
+
+  if (len != NULL) *len = size;
+  return message;
+}
+
+// Send a heartbeat if nothing has gone out for long enough
+int conn_heartbeat(conn_t* conn) {
+  if (conn->heartbeat <= 0 || now() - conn->last_sent < conn->heartbeat) return 0;
+  size_t empty = 0;
+  if (reserve(&conn->out, &conn->out_capacity, conn->out_end + sizeof(size_t))) return -1;
+  memcpy(conn->out + conn->out_end, &empty, sizeof(size_t));
+  conn->out_end += sizeof(size_t);
+  return conn_flush(conn);
+}
+
+// Send a heartbeat if one is due, and fail the connection if it has timed out. Silence only
+// counts if the last look at the socket found nothing, since after a busy spell there may be
+// plenty waiting there. Returns a non-zero value if the connection failed.
+static int conn_keepalive(conn_t* conn, bool quiet) {
+  if (conn_heartbeat(conn)) conn->failed = true;
+  if (quiet && conn->timeout > 0 && conn->heartbeats_heard &&
+      now() - conn->last_heard >= conn->timeout) {
+    errno = ETIMEDOUT;
+    conn->failed = true;
+  }
+  return conn->failed ? -1 : 0;
+}
+
+// Receive a message of up to max bytes, reading as much as needed
+static char* conn_receive_limited(conn_t* conn, size_t* len, size_t max) {
+  // Anything we queued may be what the other side is waiting on before it answers
+  if (conn_flush(conn)) return NULL;
+
+  while (true) {
+    char* message = conn_next(conn, len, max);
+    if (message != NULL) return message;
+    if (conn->failed) return NULL;
+
+    // With heartbeats or a timeout, the read gives up every so often to see to them
+    size_t received = conn->bytes_received;
+    if (conn_fill(conn) || conn_keepalive(conn, conn->bytes_received == received)) return NULL;
+  }
+}
+
+// Receive a message of arbitrary bytes
+char* conn_receive(conn_t* conn, size_t* len) {
+  return conn_receive_limited(conn, len, MAX_BYTES_LENGTH);
+}
+
+// Receive a message string
+char* conn_receive_message(conn_t* conn) {
+  return conn_receive_limited(conn, NULL, MAX_MESSAGE_LENGTH);
+}
+
+// Note whether any of the whole messages in the receive buffer are heartbeats. The buffer is only
+// read, so the last message received stays valid. Its terminator sits on the first byte after
+// it, which may be part of a header, so headers are read into a copy with that byte put back.
+static void conn_scan_heartbeats(conn_t* conn) {
+  size_t offset = conn->in_start;
+  while (!conn->heartbeats_heard && conn->in_end - offset >= sizeof(size_t)) {
+    unsigned char header[sizeof(size_t)];
+    memcpy(header, conn->in + offset, sizeof(size_t));
+    if (conn->terminated && conn->in_start >= offset && conn->in_start - offset < sizeof(size_t)) {
+      header[conn->in_start - offset] = (unsigned char)conn->saved;
+    }
+    size_t size;
+    memcpy(&size, header, sizeof(size_t));
+    if (size > MAX_BYTES_LENGTH || conn->in_end - offset - sizeof(size_t) < size) break;
+    if (size == 0) conn->heartbeats_heard = true;
+    offset += sizeof(size_t) + size;
+  }
+}
+
+// Wait for input, keeping the connection going
+int conn_wait(conn_t* conn, int input) {
+  if (conn_flush(conn)) conn->failed = true;
+  bool quiet = false;
+
+  while (!conn_keepalive(conn, quiet)) {
+    // Sleep until the next heartbeat or timeout is due, if either is
+    double time = now();
+    int wait = -1;
+    if (conn->heartbeat > 0 || (conn->timeout > 0 && conn->heartbeats_heard)) {
+      double wake = conn->heartbeat > 0 ? conn->last_sent + conn->heartbeat - time : 1e9;
+      if (conn->timeout > 0 && conn->heartbeats_heard) {
+        double silence = conn->last_heard + conn->timeout - time;
+        if (silence < wake) wake = silence;
+      }
+      wait = wake > 0 ? (int)(wake * 1000) + 1 : 0;
+    }
+
+    bool readable;
+    bool input_readable;
+    int rc = conn->transport->wait(conn, input, wait, &readable, &input_readable);
+    if (rc < 0 && errno != EINTR) conn->failed = true;
+    if (rc < 0) continue;
+
+    quiet = !readable;
+    if (!quiet) {
+      if (conn_fill(conn)) conn->failed = true;
+      conn_scan_heartbeats(conn);
+    }
+    if (input_readable) return conn->failed ? -1 : 0;
+  }
+  return -1;
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #define MAX_MESSAGE_LENGTH 2048
+#define MAX_BYTES_LENGTH (8 << 20) // Binary messages, like boards, can be much larger
 
 // Send a across a socket with a header that includes the message length. Returns non-zero value if
 // an error occurs.
@@ -9,3 +13,120 @@ int send_message(int fd, char* message);
 // Receive a message from a socket and return the message string (which must be freed later).
 // Returns NULL when an error occurs.
 char* receive_message(int fd);
+
+// Messages are written and read through this much buffer at a time
+#define CONN_BUFFER_SIZE (64 << 10)
+
+// Socket options for a buffered connection
+typedef struct conn_options {
+  bool nodelay;        // Disable Nagle's algorithm, since we flush at the points that matter
+  bool nonblocking;    // Put the socket in non-blocking mode, for use with poll or epoll
+  int send_buffer;     // SO_SNDBUF size in bytes, or zero to keep the system default
+  int receive_buffer;  // SO_RCVBUF size in bytes, or zero to keep the system default
+  double heartbeat;    // Seconds without sending anything while we wait before a heartbeat goes
+                       // out, or zero to send none
+  double timeout;      // Seconds without hearing anything before a wait gives up, or zero to wait
+                       // forever
+} conn_options_t;
+
+#define CONN_DEFAULTS {.nodelay = true, .nonblocking = false, .send_buffer = 0, \
+                       .receive_buffer = 0, .heartbeat = 0, .timeout = 0}
+
+// A buffered connection. Sent messages are queued and written together when the connection is
+// flushed, and received messages are read out of one buffer instead of a read and a malloc apiece.
+// The wire format is the same as send_message and receive_message.
+typedef struct conn {
+  int fd;
+  bool nonblocking;
+
+  // What the bytes go over. Shared memory keeps its end of the rings in link, and the socket only
+  // to notice the other side going away.
+  const struct transport* transport;
+  void* link;
+
+  // Queued outgoing bytes live between out_start and out_end
+  char* out;
+  size_t out_start, out_end, out_capacity;
+
+  // Received bytes not yet handed out live between in_start and in_end
+  char* in;
+  size_t in_start, in_end, in_capacity;
+
+  // The byte overwritten by the last message's null terminator
+  char saved;
+  bool terminated;
+  bool failed;
+
+  // A heartbeat is an empty message. They are never handed out by conn_next. The other side is
+  // only timed out once it has sent one, so peers that don't send them are waited on forever;
+  // a side that does sends its first as soon as it waits.
+  double heartbeat, timeout;
+  double wake;  // Seconds a blocking read waits before giving up to see to them, or zero
+  double last_sent, last_heard;
+  bool heartbeats_heard;
+
+  // Counters, for seeing how well messages are being coalesced
+  size_t messages_sent, messages_received;
+  size_t bytes_sent, bytes_received;
+  size_t writes, reads;
+} conn_t;
+
+// Wrap a connected socket in a buffered connection, applying options (or CONN_DEFAULTS if NULL).
+// Returns NULL if memory runs out.
+conn_t* conn_open(int fd, const conn_options_t* options);
+
+// Wrap a Unix-domain socket accepted from another process on this host, which has to join with
+// conn_join_local. With shared set, the two talk through ring buffers in shared memory from then
+// on rather than the socket. Returns NULL, with errno set, if this fails.
+conn_t* conn_open_local(int fd, const conn_options_t* options, bool shared);
+
+// Join a connection opened with conn_open_local, on whichever transport the other side chose
+conn_t* conn_join_local(int fd, const conn_options_t* options);
+
+// Flush a connection, close its socket, and free it. A non-blocking connection only gets out what
+// the socket will take right away.
+void conn_close(conn_t* conn);
+
+// Queue a message of arbitrary bytes. Large messages, or a queue that has grown large, are written
+// right away. Returns a non-zero value if an error occurs.
+int conn_send(conn_t* conn, const void* data, size_t len);
+
+// Queue a message string. Returns a non-zero value if an error occurs.
+int conn_send_message(conn_t* conn, const char* message);
+
+// Write every queued message, in as few system calls as possible. On a non-blocking connection
+// whatever the socket won't take stays queued. Returns a non-zero value if an error occurs.
+int conn_flush(conn_t* conn);
+
+// The number of bytes queued and not yet written
+size_t conn_pending(conn_t* conn);
+
+// Read whatever is available into the receive buffer, without blocking on a non-blocking
+// connection. Returns a non-zero value if an error occurs or the other side has closed.
+int conn_fill(conn_t* conn);
+
+// Return the next message already in the receive buffer, or NULL if there isn't a complete one yet.
+// Messages longer than max mark the connection as failed. The message is only valid until the
+// connection is next read from, as conn_receive's is.
+char* conn_next(conn_t* conn, size_t* len, size_t max);
+
+// Flush anything queued, then wait for a message of arbitrary bytes and store its length in *len.
+// The result is null terminated and belongs to the connection, and must not be freed. It is only
+// valid until the connection is next read from: any conn_receive, conn_next, conn_fill or
+// conn_wait may move the receive buffer or overwrite the terminator, so copy out anything that
+// has to outlive one of those. Returns NULL when an error occurs.
+char* conn_receive(conn_t* conn, size_t* len);
+
+// Like conn_receive, for message strings
+char* conn_receive_message(conn_t* conn);
+
+// Flush anything queued, then wait until an input descriptor, such as a terminal, is readable.
+// Meanwhile whatever arrives on the connection is buffered, to be received later, and heartbeats
+// go out. Returns a non-zero value if the connection fails, closes, or times out first, though
+// messages that arrived before that can still be received. Reading the connection invalidates
+// the last message received.
+int conn_wait(conn_t* conn, int input);
+
+// Send a heartbeat if one is due, for callers that are busy for a while without waiting on the
+// connection. Returns a non-zero value if an error occurs.
+int conn_heartbeat(conn_t* conn);
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "record.h"
+
+// Start writing a log
+recording_t * record_open(const char * path, int width, int height) {
+  recording_t * recording = (recording_t *) malloc(sizeof(recording_t));
+  if (recording == NULL) return NULL;
+  recording->file = fopen(path, "wb");
+  if (recording->file == NULL) {
+    free(recording);
+    return NULL;
+  }
+  recording->width = width;
+  recording->height = height;
+
+  uint8_t header[32];
+  size_t n = 0;
+  memcpy(header, RECORD_MAGIC, 4);
+  n += 4;
+  header[n++] = RECORD_VERSION;
+  n += put_varint(header + n, width);
+  n += put_varint(header + n, height);
+  fwrite(header, 1, n, recording->file);
+  fflush(recording->file);
+
+  return recording;
+}
+
+// Write a round once it is over
+int record_round(recording_t * recording, board_t board, placements_t * red, placements_t * blue,
+                 int steps, uint64_t hash) {
+  size_t red_len;
+  size_t blue_len;
+  uint8_t * red_message = encode_placements(board, red, &red_len);
+  uint8_t * blue_message = encode_placements(board, blue, &blue_len);
+  score_t score = count_board(board);
+
+  // The whole round goes out in one write, so a log cut short still ends on a whole round
+  uint8_t * out = (uint8_t *) malloc(red_len + blue_len + 64);
+  int rc = -1;
+  if (red_message != NULL && blue_message != NULL && out != NULL) {
+    size_t n = 0;
+    out[n++] = ROUND_RECORD;
+    n += put_varint(out + n, red_len);
+    memcpy(out + n, red_message, red_len);
+    n += red_len;
+    n += put_varint(out + n, blue_len);
+    memcpy(out + n, blue_message, blue_len);
+    n += blue_len;
+    n += put_varint(out + n, steps);
+    n += put_varint(out + n, score.red);
+    n += put_varint(out + n, score.blue);
+    for (int i = 0; i < 8; i++) out[n++] = (uint8_t)(hash >> (8 * i));
+
+    if (fwrite(out, 1, n, recording->file) == n && fflush(recording->file) == 0) rc = 0;
+  }
+
+  free(red_message);
+  free(blue_message);
+  free(out);
+  return rc;
+}
+
+// Finish a log and close it
+void record_close(recording_t * recording, int winner) {
+  if (recording == NULL) return;
+  if (winner != COLORLESS) {
+    uint8_t end[2] = {MATCH_END, (uint8_t)winner};
+    fwrite(end, 1, 2, recording->file);
+  }
+  fclose(recording->file);
+  free(recording);
+}
+
+// Read a whole log
+replay_t * replay_open(const char * path) {
+  FILE * file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+
+  // Logs are small, so read it all at once
+  replay_t * replay = (replay_t *) calloc(1, sizeof(replay_t));
+  size_t capacity = 4096;
+  if (replay != NULL) replay->data = (uint8_t *) malloc(capacity);
+  while (replay != NULL && replay->data != NULL) {
+    replay->len += fread(replay->data + replay->len, 1, capacity - replay->len, file);
+    if (replay->len < capacity) break;
+    capacity *= 2;
+    uint8_t * bigger = (uint8_t *) realloc(replay->data, capacity);
+    if (bigger == NULL) {
+      free(replay->data);
+      replay->data = NULL;
+    } else {
+      replay->data = bigger;
+    }
+  }
+  fclose(file);
+  if (replay == NULL || replay->data == NULL) {
+    free(replay);
+    return NULL;
+  }
+
+  // Check the header
+  const uint8_t * in = replay->data + 5;
+  const uint8_t * end = replay->data + replay->len;
+  uint64_t width;
+  uint64_t height;
+  if (replay->len < 5 || memcmp(replay->data, RECORD_MAGIC, 4) != 0 ||
+      replay->data[4] != RECORD_VERSION || !get_varint(&in, end, &width) ||
+      !get_varint(&in, end, &height) || width > MAX_BOARD_SIZE || height > MAX_BOARD_SIZE ||
+      !valid_dimensions(width, height)) {
+    replay_close(replay);
+    return NULL;
+  }
+  replay->width = width;
+  replay->height = height;
+  replay->pos = in - replay->data;
+  replay->winner = COLORLESS;
+
+  return replay;
+}
+
+// Read one of a round's placements: its length, then the message
+static bool read_placements(const uint8_t ** in, const uint8_t * end, board_t board,
+                            placements_t * placements) {
+  uint64_t len;
+  if (!get_varint(in, end, &len) || len > (uint64_t)(end - *in)) return false;
+  if (decode_placements(*in, len, board, placements)) return false;
+  *in += len;
+  return true;
+}
+
+// Read the next round
+int replay_round(replay_t * replay, board_t board, recorded_round_t * round) {
+  const uint8_t * in = replay->data + replay->pos;
+  const uint8_t * end = replay->data + replay->len;
+  if (in == end) return 0;
+
+  uint8_t kind = *in++;
+  if (kind == MATCH_END && in < end) {
+    replay->winner = *in++;
+    replay->pos = in - replay->data;
+    return 0;
+  }
+
+  uint64_t steps;
+  uint64_t red;
+  uint64_t blue;
+  if (kind != ROUND_RECORD || !read_placements(&in, end, board, &round->red) ||
+      !read_placements(&in, end, board, &round->blue) || !get_varint(&in, end, &steps) ||
+      !get_varint(&in, end, &red) || !get_varint(&in, end, &blue) || end - in < 8 ||
+      steps > MATCH_STEPS) {
+    return -1;
+  }
+
+  round->hash = 0;
+  for (int i = 0; i < 8; i++) round->hash |= (uint64_t)*in++ << (8 * i);
+  round->steps = steps;
+  round->score.red = red;
+  round->score.blue = blue;
+  round->score.diff = round->score.red - round->score.blue;
+  replay->pos = in - replay->data;
+  return 1;
+}
+
+void replay_close(replay_t * replay) {
+  if (replay == NULL) return;
+  free(replay->data);
+  free(replay);
+}
+
+// Put both players' placements on a board the way the server does
+void apply_placements(board_t board, placements_t * red, placements_t * blue) {
+  placements_t none = {0};
+  merge_placements(board, &none, red, RED);
+  merge_placements(board, red, blue, BLUE);
+}
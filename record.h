@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "conway.h"
+
+// A match log holds only what the players decided. Rounds are deterministic, so every generation
+// can be played again from it. The log is:
+//
+//   the magic bytes "C2PL" and a version byte
+//   the width and height, as varints
+//   for each round: ROUND_RECORD, then red's and blue's placements, each as the length of a
+//     placements message followed by the message, then the generations the round lasted, the
+//     red and blue cell counts it ended on as varints, and the board hash it ended on as eight
+//     bytes, low byte first
+//   MATCH_END and the winner's color, if the set was played to the end
+#define RECORD_MAGIC "C2PL"
+#define RECORD_VERSION 1
+#define ROUND_RECORD 'R'
+#define MATCH_END 'E'
+
+// A log being written
+typedef struct recording {
+  FILE * file;
+  int width;
+  int height;
+} recording_t;
+
+// One round read back out of a log
+typedef struct recorded_round {
+  placements_t red;
+  placements_t blue;
+  int steps;
+  score_t score;
+  uint64_t hash;
+} recorded_round_t;
+
+// A log being read
+typedef struct replay {
+  uint8_t * data;
+  size_t len;
+  size_t pos;
+  int width;
+  int height;
+  int winner; // COLORLESS until the end of the log has been read, or if the set never finished
+} replay_t;
+
+// Start writing a log. Returns NULL if the file can't be created.
+recording_t * record_open(const char * path, int width, int height);
+
+// Write a round once it is over: both players' placements, and how it ended. Returns non-zero if
+// writing fails.
+int record_round(recording_t * recording, board_t board, placements_t * red, placements_t * blue,
+                 int steps, uint64_t hash);
+
+// Finish a log, noting the winner of the set unless it is COLORLESS, and close it
+void record_close(recording_t * recording, int winner);
+
+// Read a whole log. Returns NULL if it can't be read or doesn't start like a log.
+replay_t * replay_open(const char * path);
+
+// Read the next round. Returns 1 if there was one, 0 at the end of the log, and -1 if the log is
+// malformed. board is only used for its dimensions.
+int replay_round(replay_t * replay, board_t board, recorded_round_t * round);
+
+void replay_close(replay_t * replay);
+
+// Put both players' placements on a board the way the server does: red's first, then blue's
+// merged in
+void apply_placements(board_t board, placements_t * red, placements_t * blue);
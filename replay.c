@@ -0,0 +1,240 @@
+#include <ncurses.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "conway.h"
+#include "record.h"
+#include "ui.h"
+
+/*
+ * Replay Program
+ *
+ * Plays match logs back. By default every log is checked headless at full speed: each round is
+ * played again from its placements and has to end just as the log says it did. With -s, the logs
+ * are shown on the terminal instead, at that many generations a second.
+ */
+
+#define REPORT_LENGTH 256
+
+// The logs to check, shared by the jobs checking them
+static struct {
+  pthread_mutex_t lock;
+  char ** paths;
+  int count;
+  int next;
+  char (* reports)[REPORT_LENGTH];
+  bool * failed;
+  long rounds;
+  long generations;
+} logs = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Play a log again, checking every round ends the way it was logged. Returns false if one doesn't,
+// or the log is malformed, with what happened written to report.
+static bool check_log(const char * path, char * report, long * rounds, long * generations) {
+  replay_t * replay = replay_open(path);
+  if (replay == NULL) {
+    snprintf(report, REPORT_LENGTH, "%s: not a match log", path);
+    return false;
+  }
+
+  board_t board = acquire_board(replay->width, replay->height);
+  if (board == NULL) exit(EXIT_FAILURE);
+  recorded_round_t recorded = {0};
+  int red_wins = 0;
+  int blue_wins = 0;
+  int number = 0;
+  bool ok = true;
+  int rc;
+  while ((rc = replay_round(replay, board, &recorded)) == 1) {
+    number++;
+    apply_placements(board, &recorded.red, &recorded.blue);
+
+    round_t round;
+    start_round(&round, board);
+    while (step_round(&round, board)) {}
+    *generations += round.step;
+
+    score_t score = count_board(board);
+    if (round.step != recorded.steps || score.red != recorded.score.red ||
+        score.blue != recorded.score.blue || board->hash != recorded.hash) {
+      snprintf(report, REPORT_LENGTH, "%s: round %d doesn't end the way it was logged", path,
+               number);
+      ok = false;
+      break;
+    }
+    if (score.diff > 0) red_wins++;
+    if (score.diff < 0) blue_wins++;
+  }
+  *rounds += number;
+
+  if (ok && rc < 0) {
+    snprintf(report, REPORT_LENGTH, "%s: malformed after round %d", path, number);
+    ok = false;
+  } else if (ok) {
+    snprintf(report, REPORT_LENGTH, "%s: %dx%d, %d rounds, red %d blue %d, %s", path,
+             replay->width, replay->height, number, red_wins, blue_wins,
+             replay->winner == RED ? "red won the set" :
+             replay->winner == BLUE ? "blue won the set" : "unfinished");
+  }
+
+  free(recorded.red.cells);
+  free(recorded.blue.cells);
+  release_board(board);
+  replay_close(replay);
+  return ok;
+}
+
+// A job checking logs until there are none left
+static void * check_logs(void * arg) {
+  long rounds = 0;
+  long generations = 0;
+  while (true) {
+    pthread_mutex_lock(&logs.lock);
+    int i = logs.next++;
+    pthread_mutex_unlock(&logs.lock);
+    if (i >= logs.count) break;
+
+    logs.failed[i] = !check_log(logs.paths[i], logs.reports[i], &rounds, &generations);
+  }
+
+  pthread_mutex_lock(&logs.lock);
+  logs.rounds += rounds;
+  logs.generations += generations;
+  pthread_mutex_unlock(&logs.lock);
+  return NULL;
+}
+
+// Show a log on the terminal at some number of generations a second. Returns false if the viewer
+// quit.
+static bool watch_log(const char * path, double speed, WINDOW * w_board, WINDOW * w_status) {
+  replay_t * replay = replay_open(path);
+  if (replay == NULL) return true;
+
+  board_t board = acquire_board(replay->width, replay->height);
+  if (board == NULL) exit(EXIT_FAILURE);
+  recorded_round_t recorded = {0};
+  int delay = (int)(1000 / speed);
+  int number = 0;
+  bool watching = true;
+  while (watching && replay_round(replay, board, &recorded) == 1) {
+    number++;
+    apply_placements(board, &recorded.red, &recorded.blue);
+    print_board(board, w_board, w_status);
+    werase(w_status);
+    wprintw(w_status, "%s: round %d", path, number);
+    wrefresh(w_status);
+    napms(1000);
+
+    round_t round;
+    start_round(&round, board);
+    while (watching && step_round(&round, board)) {
+      print_board(board, w_board, w_status);
+      napms(delay);
+      watching = getch() != 'q';
+    }
+
+    score_t score = count_board(board);
+    werase(w_status);
+    wprintw(w_status, "%s: round %d, %s", path, number,
+            score.diff > 0 ? "red won" : score.diff < 0 ? "blue won" : "a tie");
+    wrefresh(w_status);
+    if (watching) napms(1000);
+  }
+
+  free(recorded.red.cells);
+  free(recorded.blue.cells);
+  release_board(board);
+  replay_close(replay);
+  return watching;
+}
+
+int main(int argc, char ** argv) {
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  double speed = 0;
+  bool quiet = false;
+
+  // Read command line options
+  int opt;
+  bool valid = true;
+  while ((opt = getopt(argc, argv, "j:t:s:q")) != -1) {
+    switch (opt) {
+    case 'j':
+      // Logs checked at once
+      jobs = atoi(optarg);
+      break;
+    case 't':
+      // Threads used to update a board
+      set_update_threads(atoi(optarg));
+      break;
+    case 's':
+      // Generations a second to show the logs at
+      speed = atof(optarg);
+      if (speed <= 0) valid = false;
+      break;
+    case 'q':
+      // Only report the logs that fail
+      quiet = true;
+      break;
+    default:
+      valid = false;
+    }
+  }
+
+  if (!valid || jobs < 1 || optind == argc) {
+    fprintf(stderr, "Usage: %s [-j jobs] [-t threads] [-q] [-s speed] log...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (speed > 0) {
+    // Watch the logs one after another
+    initscr();
+    noecho();
+    cbreak();
+    curs_set(0);
+    start_color();
+    timeout(0);
+    refresh();
+
+    WINDOW * w_board = newwin(LINES - 3, COLS - 2, 2, 1);
+    WINDOW * w_status = newwin(1, COLS, 0, 0);
+    for (int i = optind; i < argc && watch_log(argv[i], speed, w_board, w_status); i++) {}
+    endwin();
+    return 0;
+  }
+
+  // Check every log, as many at a time as we have jobs
+  logs.paths = argv + optind;
+  logs.count = argc - optind;
+  logs.reports = calloc(logs.count, REPORT_LENGTH);
+  logs.failed = (bool *) calloc(logs.count, sizeof(bool));
+  pthread_t * threads = (pthread_t *) malloc(sizeof(pthread_t) * jobs);
+  if (logs.reports == NULL || logs.failed == NULL || threads == NULL) exit(EXIT_FAILURE);
+
+  double start = now();
+  for (int i = 0; i < jobs; i++) {
+    if (pthread_create(&threads[i], NULL, check_logs, NULL)) exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+  double seconds = now() - start;
+  drain_board_pool();
+
+  int failures = 0;
+  for (int i = 0; i < logs.count; i++) {
+    if (logs.failed[i]) failures++;
+    if (logs.failed[i] || !quiet) printf("%s\n", logs.reports[i]);
+  }
+  fprintf(stderr, "%d logs, %ld rounds, %ld generations in %.3fs, %d failed\n", logs.count,
+          logs.rounds, logs.generations, seconds, failures);
+
+  return failures ? EXIT_FAILURE : 0;
+}
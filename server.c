@@ -1,34 +1,159 @@
 #include <ncurses.h>
 #include <stdlib.h>
+#include "bot.h"
 #include "conway.h"
+#include "record.h"
 #include "socket.h"
+#include "spectate.h"
+#include "stats.h"
+#include "ui.h"
 
 /*
  * Server Program
  */
 
-int main() {
+int main(int argc, char ** argv) {
+  // Board dimensions default to a square of BOARD_SIZE
+  int width = BOARD_SIZE;
+  int height = BOARD_SIZE;
+
+  // Generations between the client's checkpoints when it runs rounds on its own. Zero keeps the
+  // client in lockstep with us, one generation at a time.
+  int checkpoint = 0;
+
+  // With a budget, a bot places our cells instead of the player
+  bool bot = false;
+  bot_budget_t budget;
+
+  // Where to log the match, if anywhere
+  char * log_path = NULL;
+
+  // Where to write timings, if anywhere
+  char * stats_path = NULL;
+
+  // Seconds of silence from the client before we give up on it
+  double timeout = PEER_TIMEOUT;
+
+  // A client on this machine can connect through a Unix-domain socket instead of a TCP port, and
+  // then talk to us through shared memory
+  char * local_path = NULL;
+  bool shared = false;
+
+  // Read command line options
+  int opt;
+  while ((opt = getopt(argc, argv, "t:w:h:c:b:l:s:T:u:m")) != -1) {
+    switch (opt) {
+    case 't':
+      // Threads used to update the board
+      set_update_threads(atoi(optarg));
+      break;
+    case 'w':
+      width = atoi(optarg);
+      break;
+    case 'h':
+      height = atoi(optarg);
+      break;
+    case 'c':
+      checkpoint = atoi(optarg);
+      break;
+    case 'b':
+      // Simulations, or a time like 2s, the bot may spend on each move
+      bot = true;
+      if (!bot_parse_budget(optarg, &budget)) width = 0;
+      break;
+    case 'l':
+      log_path = optarg;
+      break;
+    case 's':
+      stats_path = optarg;
+      break;
+    case 'T':
+      // Zero waits forever
+      timeout = atof(optarg);
+      break;
+    case 'u':
+      local_path = optarg;
+      break;
+    case 'm':
+      shared = true;
+      break;
+    default:
+      width = 0;
+    }
+  }
+
+  if (!valid_dimensions(width, height) || checkpoint < 0 || timeout < 0 ||
+      (shared && local_path == NULL)) {
+    fprintf(stderr, "Usage: %s [-t threads] [-w width] [-h height] [-c checkpoint] [-b budget] "
+            "[-l log] [-s stats] [-T timeout] [-u socket path [-m]]\n", argv[0]);
+    fprintf(stderr, "Width and height must be between 1 and %d\n", MAX_BOARD_SIZE);
+    exit(EXIT_FAILURE);
+  }
+
+  if (stats_path != NULL && stats_open(stats_path)) {
+    perror("Couldn't start collecting stats");
+    exit(EXIT_FAILURE);
+  }
+
+  recording_t * recording = NULL;
+  if (log_path != NULL && (recording = record_open(log_path, width, height)) == NULL) {
+    perror("Couldn't create the match log");
+    exit(EXIT_FAILURE);
+  }
+
   // Listening for a client
   unsigned short port = 0;
-  int server_socket = server_socket_open(&port);
+  int server_socket = local_path ? local_socket_open(local_path) : server_socket_open(&port);
 
-  if (server_socket == -1) exit(-1);
+  if (server_socket == -1) {
+    perror("Couldn't open the server socket");
+    exit(-1);
+  }
 
-  printf("Server listening on port %u\n",port);
+  if (local_path) {
+    printf("Server listening on %s\n",local_path);
+  } else {
+    printf("Server listening on port %u\n",port);
+  }
 
   if (listen(server_socket, 1)) {
     perror("listen failed");
     exit(EXIT_FAILURE);
   }
 
+  // Anyone else may watch, on a port of their own
+  unsigned short spectator_port = 0;
+  spectators_t * spectators = spectators_open(&spectator_port);
+  if (spectators != NULL) printf("Spectators can watch on port %u\n",spectator_port);
+
   // Accepting the client
   int client_socket = server_socket_accept(server_socket);
   if (client_socket == -1) {
     perror("accept failed");
   }
 
+  // Only the one client ever connects, so nobody needs to find the socket again
+  if (local_path) unlink(local_path);
+
   printf("Found opponent!\n");
 
+  // Messages to the client are buffered, and only go out together at the flush points below.
+  // Whenever we wait, on the client or the player, heartbeats go out and the client's are
+  // checked for.
+  conn_options_t options = CONN_DEFAULTS;
+  options.heartbeat = HEARTBEAT_INTERVAL;
+  options.timeout = timeout;
+  conn_t * client = local_path ? conn_open_local(client_socket, &options, shared)
+                              : conn_open(client_socket, &options);
+  if (client == NULL) exit(-1);
+  stats_connection(client,"client");
+
+  // Tell the client how big the board is
+  if (send_dimensions(client, width, height, BLUE) || conn_flush(client)) {
+    printf("Connection lost.\n");
+    return -1;
+  }
+
   // Initialize ncurses
   initscr();
   noecho();
@@ -40,13 +165,16 @@ int main() {
   refresh();
 
   // Windows to draw the board and status bar
-  WINDOW * w_board = newwin(BOARD_SIZE,BOARD_SIZE,2,1);
-  WINDOW * w_status = newwin(1,BOARD_SIZE,0,0);
-
-  for (int x=0;x<=BOARD_SIZE+1;x++) {
-    for (int y=1;y<=BOARD_SIZE+2;y++) {
-      if ((x==0 || x==BOARD_SIZE+1) ||
-	        (y==1 || y==BOARD_SIZE+2)) {
+  // Only as much of the board as fits in the terminal is shown
+  int view_width = width < COLS - 2 ? width : COLS - 2;
+  int view_height = height < LINES - 3 ? height : LINES - 3;
+  WINDOW * w_board = newwin(view_height,view_width,2,1);
+  WINDOW * w_status = newwin(1,COLS,0,0);
+
+  for (int x=0;x<=view_width+1;x++) {
+    for (int y=1;y<=view_height+2;y++) {
+      if ((x==0 || x==view_width+1) ||
+	        (y==1 || y==view_height+2)) {
 	      mvaddch(y,x,'*');
       }
     }
@@ -56,7 +184,7 @@ int main() {
   move(2,1);
 
   // Create an empty board
-  board_t board = create_board();
+  board_t board = create_board(width, height);
 
   // Five matches, score is 0/0, no bonus cells to start
   int matches = 5;
@@ -67,89 +195,161 @@ int main() {
   // Store responses from client
   char * client_message;
 
+  // The cells each of us placed this round
+  placements_t ours = {0};
+  placements_t theirs = {0};
+
   while (matches > 0) {
     // Tell the client to set the board, then set our own board
-    send_message(client_socket,"setboard");
-    set_board(10+bonus,RED,board,w_board,w_status);
-    wclear(w_status);
+    conn_send_message(client,"setboard");
+    conn_flush(client);
+    double begin = stats_begin();
+    if (bot) {
+      bot_set_board(10+bonus,RED,board,&ours,budget,client);
+      print_board(board,w_board,w_status);
+    } else {
+      set_board(10+bonus,RED,board,&ours,w_board,w_status,client);
+    }
+    stats_end(PHASE_PLACE,begin);
+    werase(w_status);
     wprintw(w_status, "Waiting on opponent...");
     wrefresh(w_status);
 
-    // Get the board back from the client
-    board_t opponent_board = recv_board(client_socket);
-
-    // Normalize the board
-    for (int x = 0; x < BOARD_SIZE; x++) {
-      for (int y = 0; y < BOARD_SIZE; y++) {
-        if (opponent_board[x][y].alive) {
-          if (board[x][y].alive && board[x][y].color != opponent_board[x][y].color) {
-            board[x][y].alive = false;
-            board[x][y].future = false;
-            board[x][y].color = COLORLESS;
-          } else {
-            board[x][y].color = opponent_board[x][y].color;
-            board[x][y].alive = true;
-            board[x][y].future = true;
-          }
-        }
-      }
+    // Swap placements with the client
+    if (recv_placements(client,board,&theirs) ||
+        send_placements(client,board,&ours)) {
+      endwin();
+      printf("Connection lost.\n");
+      return -1;
     }
 
-    // Send the client the new board
-    free(opponent_board);
-    send_board(client_socket,board);
+    // We both merge them into our boards, and our hash lets the client check it got the same
+    merge_placements(board,&ours,&theirs,BLUE);
+    spectators_publish(spectators,board);
+    begin = stats_begin();
+    char hash[HASH_LENGTH];
+    hash_string(board,hash);
+    conn_send_message(client,hash);
+    conn_flush(client);
+    stats_end(PHASE_EXCHANGE,begin);
 
     // Display the board
     print_board(board,w_board,w_status);
-    wclear(w_status);
+    werase(w_status);
     wprintw(w_status,"Hit any key to begin.");
     wrefresh(w_status);
-    getch();
+    if (!bot) wait_key(client);
 
     // Done displaying, waiting for opponent now
-    wclear(w_status);
+    werase(w_status);
     wprintw(w_status,"Waiting on opponent...");
     wrefresh(w_status);
 
     // Client is ready to start
-    client_message = receive_message(client_socket);
+    begin = stats_begin();
+    client_message = conn_receive_message(client);
+    stats_end(PHASE_WAIT,begin);
     if (client_message == NULL) {
       // Scratch that, client is disconnected actually
       endwin();
       printf("Connection lost.\n");
       return -1;
     }
-    free(client_message);
+    if (strcmp(client_message,"desynced") == 0) {
+      // Or it merged the placements into a different board
+      endwin();
+      printf("Desynced, giving up.\n");
+      return -1;
+    }
 
     score_t score;
     // Score of the match
 
-    for (int steps = 0; steps < 75; steps++) {
-      // 75 times, update the board and tell the client to do so as well
-      update_board(board);
+    round_t round;
+    start_round(&round,board);
+
+    if (checkpoint > 0) {
+      // Let the client play the round on its own, sending us a hash every so often
+      char run[32];
+      snprintf(run,sizeof(run),"run %d",checkpoint);
+      conn_send_message(client,run);
+      conn_flush(client);
+
+      // Play the round ourselves, remembering how the board hashed at each step
+      char hashes[MATCH_STEPS + 1][HASH_LENGTH];
+      while (step_round(&round,board)) {
+        score = animate_board(board,w_board,w_status);
+        spectators_publish(spectators,board);
+        hash_string(board,hashes[round.step]);
+        conn_heartbeat(client);
+      }
       score = print_board(board,w_board,w_status);
-      
-      send_message(client_socket,"update");
 
-      // Get the hash back from the client after each update
-      // Currently unimplemented, the hash is just "hash"
-      client_message = receive_message(client_socket);
-      if (client_message == NULL) {
-        endwin();
-        printf("Connection lost.\n");
-        return -1;
+      // Now go through the client's checkpoints, up to the one marking the end of its round
+      bool done = false;
+      while (!done) {
+        begin = stats_begin();
+        client_message = conn_receive_message(client);
+        stats_end(PHASE_WAIT,begin);
+        if (client_message == NULL) {
+          endwin();
+          printf("Connection lost.\n");
+          return -1;
+        }
+        int step;
+        char hash[HASH_LENGTH];
+        done = strncmp(client_message,"done ",5) == 0;
+        if ((!done && strncmp(client_message,"check ",6) != 0) ||
+            sscanf(client_message + 5,"%d %16s",&step,hash) != 2 ||
+            step < 1 || step > round.step || (done && step != round.step) ||
+            strcmp(hash,hashes[step]) != 0) {
+          conn_send_message(client,"desynced");
+          conn_close(client);
+          endwin();
+          printf("Desynced, giving up.\n");
+          return -1;
+        }
       }
-      if (strcmp(client_message,"hash") != 0) {
-        // If they didn't say "hash", tell them we're breaking up
-        send_message(client_socket,"desynced");
-        // I'm sorry, I just think I should see other clients
-        endwin();
-        // And you should meet some different servers
-        printf("Desynced, giving up.\n");
-        // I just don't think we can work out
-        return -1;
+    } else {
+      while (step_round(&round,board)) {
+        // Until the round is over, update the board and tell the client to do so as well. That is
+        // MATCH_STEPS times, or fewer if the board settles down first.
+        score = animate_board(board,w_board,w_status);
+        spectators_publish(spectators,board);
+        
+        begin = stats_begin();
+        conn_send_message(client,"update");
+
+        // Get the hash back from the client after each update
+        client_message = conn_receive_message(client);
+        stats_end(PHASE_ROUND_TRIP,begin);
+        if (client_message == NULL) {
+          endwin();
+          printf("Connection lost.\n");
+          return -1;
+        }
+        char hash[HASH_LENGTH];
+        hash_string(board,hash);
+        if (strcmp(client_message,hash) != 0) {
+          // If their board doesn't hash like ours, tell them we're breaking up
+          conn_send_message(client,"desynced");
+          conn_close(client);
+          // I'm sorry, I just think I should see other clients
+          endwin();
+          // And you should meet some different servers
+          printf("Desynced, giving up.\n");
+          // I just don't think we can work out
+          return -1;
+        }
       }
-      free(client_message);
+      score = print_board(board,w_board,w_status);
+    }
+
+    // Log the round. If that stops working, give up on the log rather than the match.
+    if (recording != NULL &&
+        record_round(recording,board,&ours,&theirs,round.step,board->hash)) {
+      record_close(recording,COLORLESS);
+      recording = NULL;
     }
 
     // The match is done, let's see who won
@@ -159,23 +359,25 @@ int main() {
       matches--;
 
       // Nyeh nyeh, we won!
-      send_message(client_socket,"swin");
-      wclear(w_status);
+      conn_send_message(client,"swin");
+      conn_flush(client);
+      werase(w_status);
       wprintw(w_status,"You won! Hit any key.");
       wrefresh(w_status);
-      getch();
+      if (!bot) wait_key(client);
 
       // Done celebrating, wait for opponent to stop sulking
-      wclear(w_status);
+      werase(w_status);
       wprintw(w_status,"Waiting on opponent...");
       wrefresh(w_status);
-      client_message = receive_message(client_socket);
+      begin = stats_begin();
+      client_message = conn_receive_message(client);
+      stats_end(PHASE_WAIT,begin);
       if (client_message == NULL) {
         endwin();
         printf("Connection lost.\n");
         return -1;
       }
-      free(client_message);
     } else if (score.diff < 0) {
       // Darn, we lost. Guess I'll update the score
       clientwins++;
@@ -183,55 +385,66 @@ int main() {
       bonus += LOSS_BONUS;
 
       // Admit defeat
-      send_message(client_socket,"cwin");
-      wclear(w_status);
+      conn_send_message(client,"cwin");
+      conn_flush(client);
+      werase(w_status);
       wprintw(w_status,"You lost! Hit any key.");
       wrefresh(w_status);
-      getch();
+      if (!bot) wait_key(client);
 
       // Wait for opponent to stop celebrating and get on with it
-      wclear(w_status);
+      werase(w_status);
       wprintw(w_status,"Waiting on opponent...");
       wrefresh(w_status);
-      client_message = receive_message(client_socket);
+      begin = stats_begin();
+      client_message = conn_receive_message(client);
+      stats_end(PHASE_WAIT,begin);
       if (client_message == NULL) {
         endwin();
         printf("Connection lost.\n");
         return -1;
       }
-      free(client_message);
     } else if (score.diff == 0) {
       // We tied, tell the opponent
-      send_message(client_socket,"tie");
-      wclear(w_status);
+      conn_send_message(client,"tie");
+      conn_flush(client);
+      werase(w_status);
       wprintw(w_status,"It's a tie! Hit any key.");
       wrefresh(w_status);
-      getch();
+      if (!bot) wait_key(client);
 
       // Wait for opponent to get ready
-      wclear(w_status);
+      werase(w_status);
       wprintw(w_status,"Waiting on opponent...");
       wrefresh(w_status);
-      client_message = receive_message(client_socket);
+      begin = stats_begin();
+      client_message = conn_receive_message(client);
+      stats_end(PHASE_WAIT,begin);
       if (client_message == NULL) {
         endwin();
         printf("Connection lost.\n");
         return -1;
       }
-      free(client_message);
     }
   }
 
   // All the matches are done! Now figure out who won
+  free_board(board);
+  free(ours.cells);
+  free(theirs.cells);
+  spectators_close(spectators);
+  record_close(recording, serverwins < clientwins ? BLUE : RED);
   if (serverwins < clientwins) {
     // It is not us who won
-    send_message(client_socket,"cwin");
+    conn_send_message(client,"cwin");
+    conn_close(client);
     endwin();
     printf("You lost the set. Better luck next time!\n");
     return 0;
   } else {
     // Oh! We won. Yippee
-    send_message(client_socket,"swin");
+    conn_send_message(client,"swin");
+    conn_close(client);
     endwin();
     printf("You won the set!\n");
     return 0;
@@ -4,6 +4,8 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/types.h>
 #include <string.h>
 #include <unistd.h>
@@ -122,3 +124,88 @@ static int server_socket_accept(int server_socket_fd) {
 
   return client_socket_fd;
 }
+
+/**
+ * Fill in the address of a Unix-domain socket.
+ *
+ * \param path    The path of the socket in the filesystem.
+ * \param addr    The address to fill in.
+ *
+ * \returns       Zero, or -1 with errno set to ENAMETOOLONG if the path does
+ *                not fit in an address.
+ */
+static int local_socket_address(const char* path, struct sockaddr_un* addr) {
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+/**
+ * Create a new Unix-domain socket and connect to a server on this machine.
+ *
+ * \param path    The path the server's socket is bound to.
+ *
+ * \returns       A file descriptor for the connected socket, or -1 if there is
+ *                an error. The errno value will be set by the failed POSIX call.
+ */
+static int local_socket_connect(const char* path) {
+  struct sockaddr_un addr;
+  if (local_socket_address(path, &addr)) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_un))) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * Open a server socket that will accept connections from processes on this
+ * machine only, through a Unix-domain socket. Connections skip the TCP stack
+ * entirely. Accept them with server_socket_accept.
+ *
+ * \param path    The path to bind the socket to. A socket left there by an
+ *                earlier server is replaced, but nothing else is.
+ *
+ * \returns       A file descriptor for the server socket. The socket has been
+ *                bound, but is not listening. In case of failure, this function
+ *                returns -1. The value of errno will be set by the POSIX
+ *                function that failed.
+ */
+static int local_socket_open(const char* path) {
+  struct sockaddr_un addr;
+  if (local_socket_address(path, &addr)) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return -1;
+  }
+
+  // A socket file outlives the server that bound it
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_un))) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sparse.h"
+
+#define MIN_CAPACITY 64 // Slots a table starts with; capacities are always powers of two
+#define LOCKED RULE_LOCKED // Set in a live cell's value, beside its color
+
+// An open-addressing hash table from a cell to a byte, probed linearly. A value of zero marks an
+// empty slot, so every value stored must be non-zero. It holds the live cells, valued by color
+// and lock, and while a generation is worked out, the neighbor counts of the cells around them.
+typedef struct table {
+  uint64_t * keys;
+  uint8_t * values;
+  size_t capacity;
+  size_t count;
+  int shift; // 64 less the bits in a slot number
+} table_t;
+
+struct sparse {
+  int width;  // Or SPARSE_UNBOUNDED
+  int height;
+  uint64_t hash;
+  table_t live;
+  table_t next;   // Scratch table the next generation is written into
+  table_t counts; // Live neighbors of every cell next to a live cell: the total in the low four
+                  // bits, and how many are red in the high four
+  uint8_t rules[2][256]; // The rule entry for a dead or live cell, by its count
+};
+
+// Pack a cell's coordinates into a key, and back
+static inline uint64_t cell_of(int row, int column) {
+  return (uint64_t)(uint32_t)row << 32 | (uint32_t)column;
+}
+
+static inline int row_of(uint64_t key) {
+  return (int)(uint32_t)(key >> 32);
+}
+
+static inline int column_of(uint64_t key) {
+  return (int)(uint32_t)key;
+}
+
+// The slot a key would like to be in
+static inline size_t home_slot(table_t * table, uint64_t key) {
+  return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> table->shift);
+}
+
+// Set up an empty table with some number of slots. Returns non-zero if memory runs out.
+static int table_init(table_t * table, size_t capacity) {
+  table->keys = (uint64_t *) malloc(sizeof(uint64_t) * capacity);
+  table->values = (uint8_t *) calloc(capacity, 1);
+  if (table->keys == NULL || table->values == NULL) {
+    free(table->keys);
+    free(table->values);
+    return -1;
+  }
+  table->capacity = capacity;
+  table->count = 0;
+  table->shift = 64 - __builtin_ctzll(capacity);
+  return 0;
+}
+
+static void table_free(table_t * table) {
+  free(table->keys);
+  free(table->values);
+}
+
+static void table_clear(table_t * table) {
+  memset(table->values, 0, table->capacity);
+  table->count = 0;
+}
+
+// Return the value stored for a key, or NULL if there isn't one
+static uint8_t * table_find(table_t * table, uint64_t key) {
+  size_t mask = table->capacity - 1;
+  for (size_t i = home_slot(table, key); table->values[i]; i = (i + 1) & mask) {
+    if (table->keys[i] == key) return &table->values[i];
+  }
+  return NULL;
+}
+
+// Double a table's slots once it is half full, keeping what is in it. Returns non-zero if memory
+// runs out, in which case the table is unchanged.
+static int table_grow(table_t * table) {
+  table_t bigger;
+  if (table_init(&bigger, table->capacity * 2)) return -1;
+  size_t mask = bigger.capacity - 1;
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (!table->values[i]) continue;
+    size_t j = home_slot(&bigger, table->keys[i]);
+    while (bigger.values[j]) j = (j + 1) & mask;
+    bigger.keys[j] = table->keys[i];
+    bigger.values[j] = table->values[i];
+  }
+  bigger.count = table->count;
+  table_free(table);
+  *table = bigger;
+  return 0;
+}
+
+// Return the value stored for a key, adding the key with a value of zero, which the caller must
+// then set, if it isn't there. Returns NULL if memory runs out.
+static uint8_t * table_insert(table_t * table, uint64_t key) {
+  if (table->count * 2 >= table->capacity && table_grow(table)) return NULL;
+  size_t mask = table->capacity - 1;
+  size_t i = home_slot(table, key);
+  for (; table->values[i]; i = (i + 1) & mask) {
+    if (table->keys[i] == key) return &table->values[i];
+  }
+  table->keys[i] = key;
+  table->count++;
+  return &table->values[i];
+}
+
+// Remove a key, moving the keys probed after it back so none of them is cut off from its home
+static void table_remove(table_t * table, uint64_t key) {
+  size_t mask = table->capacity - 1;
+  size_t i = home_slot(table, key);
+  while (table->values[i] && table->keys[i] != key) i = (i + 1) & mask;
+  if (!table->values[i]) return;
+
+  for (size_t j = (i + 1) & mask; table->values[j]; j = (j + 1) & mask) {
+    // An entry can fill the gap unless its home lies after the gap, up to where it sits
+    size_t home = home_slot(table, table->keys[j]);
+    bool stays = i < j ? (home > i && home <= j) : (home > i || home <= j);
+    if (!stays) {
+      table->keys[i] = table->keys[j];
+      table->values[i] = table->values[j];
+      i = j;
+    }
+  }
+  table->values[i] = 0;
+  table->count--;
+}
+
+// Whether a cell is on the playfield
+static inline bool on_field(sparse_t * sparse, int row, int column) {
+  return (sparse->height == SPARSE_UNBOUNDED || (row >= 0 && row < sparse->height)) &&
+         (sparse->width == SPARSE_UNBOUNDED || (column >= 0 && column < sparse->width));
+}
+
+// Create an empty engine
+sparse_t * sparse_create(int width, int height) {
+  if (width < 0 || height < 0) return NULL;
+  sparse_t * sparse = (sparse_t *) calloc(1, sizeof(sparse_t));
+  if (sparse == NULL) return NULL;
+  sparse->width = width;
+  sparse->height = height;
+  for (int count = 0; count < 256; count++) {
+    sparse->rules[0][count] = rule_entry(false, count & 0x0f, count >> 4);
+    sparse->rules[1][count] = rule_entry(true, count & 0x0f, count >> 4);
+  }
+  if (table_init(&sparse->live, MIN_CAPACITY) || table_init(&sparse->next, MIN_CAPACITY) ||
+      table_init(&sparse->counts, MIN_CAPACITY)) {
+    sparse_free(sparse);
+    return NULL;
+  }
+  return sparse;
+}
+
+void sparse_free(sparse_t * sparse) {
+  table_free(&sparse->live);
+  table_free(&sparse->next);
+  table_free(&sparse->counts);
+  free(sparse);
+}
+
+cell_t sparse_get_cell(sparse_t * sparse, int row, int column) {
+  cell_t cell = {false, COLORLESS, false};
+  uint8_t * value = table_find(&sparse->live, cell_of(row, column));
+  if (value != NULL) {
+    cell.alive = true;
+    cell.color = *value & (RED | BLUE);
+    cell.locked = (*value & LOCKED) != 0;
+  }
+  return cell;
+}
+
+// Set the contents of a cell. Only live cells are stored, so a dead cell is never locked.
+int sparse_set_cell(sparse_t * sparse, int row, int column, int color, bool locked) {
+  if (!on_field(sparse, row, column)) return 0;
+  uint64_t key = cell_of(row, column);
+  uint8_t * value = table_find(&sparse->live, key);
+  if (value != NULL) {
+    sparse->hash ^= cell_key(row, column, *value & (RED | BLUE));
+    table_remove(&sparse->live, key);
+  }
+  if (color != RED && color != BLUE) return 0;
+
+  value = table_insert(&sparse->live, key);
+  if (value == NULL) return -1;
+  *value = color | (locked ? LOCKED : 0);
+  sparse->hash ^= cell_key(row, column, color);
+  return 0;
+}
+
+void sparse_clear(sparse_t * sparse) {
+  table_clear(&sparse->live);
+  sparse->hash = 0;
+}
+
+// Replace the engine's cells with a board's
+int sparse_load(sparse_t * sparse, board_t board) {
+  sparse_clear(sparse);
+  for (int row = 0; row < board->height; row++) {
+    for (int word = 0; word < board->words; word++) {
+      size_t i = (size_t)row * board->words + word;
+      uint64_t alive = board->red[i] | board->blue[i];
+      while (alive) {
+        int bit = __builtin_ctzll(alive);
+        alive &= alive - 1;
+        int color = board->red[i] >> bit & 1 ? RED : BLUE;
+        bool locked = board->locked[i] >> bit & 1;
+        if (sparse_set_cell(sparse, row, word * WORD_BITS + bit, color, locked)) return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Write the engine's cells onto a board
+void sparse_store(sparse_t * sparse, board_t board) {
+  clear_board(board);
+  table_t * live = &sparse->live;
+  for (size_t i = 0; i < live->capacity; i++) {
+    if (!live->values[i]) continue;
+    set_cell(board, row_of(live->keys[i]), column_of(live->keys[i]),
+             live->values[i] & (RED | BLUE), (live->values[i] & LOCKED) != 0);
+  }
+}
+
+// Advance one generation. Every live cell adds itself to the counts of its neighbors, and then
+// only cells with a count can be alive next time, as the rule entry for their count says.
+int sparse_step(sparse_t * sparse) {
+  table_t * live = &sparse->live;
+  table_t * counts = &sparse->counts;
+  table_t * next = &sparse->next;
+
+  table_clear(counts);
+  for (size_t i = 0; i < live->capacity; i++) {
+    if (!live->values[i]) continue;
+    int row = row_of(live->keys[i]);
+    int column = column_of(live->keys[i]);
+    uint8_t add = (live->values[i] & RED) ? 0x11 : 0x01;
+
+    for (int dr = -1; dr <= 1; dr++) {
+      for (int dc = -1; dc <= 1; dc++) {
+        if (dr == 0 && dc == 0) continue;
+        // Off an unbounded edge, coordinates wrap around
+        int r = (int)(uint32_t)((uint32_t)row + dr);
+        int c = (int)(uint32_t)((uint32_t)column + dc);
+        if (!on_field(sparse, r, c)) continue;
+        uint8_t * count = table_insert(counts, cell_of(r, c));
+        if (count == NULL) return -1;
+        *count += add;
+      }
+    }
+  }
+
+  table_clear(next);
+  uint64_t hash = 0;
+  for (size_t i = 0; i < counts->capacity; i++) {
+    uint8_t count = counts->values[i];
+    if (!count) continue;
+
+    // Nothing with under 2 neighbors or over 3 lives, so there's no need to look the cell up
+    uint8_t * rules = sparse->rules[0];
+    uint8_t state = 0;
+    uint64_t key = counts->keys[i];
+    if (sparse->rules[1][count]) {
+      uint8_t * current = table_find(live, key);
+      if (current != NULL) {
+        rules = sparse->rules[1];
+        state = *current;
+      }
+    }
+    uint8_t entry = rules[count];
+    uint8_t value = (state & (entry >> 4)) | (entry & 0x0f);
+    if (!value) continue;
+
+    uint8_t * slot = table_insert(next, key);
+    if (slot == NULL) return -1;
+    *slot = value;
+    hash ^= cell_key(row_of(key), column_of(key), value & (RED | BLUE));
+  }
+
+  table_t swap = *live;
+  *live = *next;
+  *next = swap;
+  sparse->hash = hash;
+  return 0;
+}
+
+// Advance any number of generations
+int sparse_run(sparse_t * sparse, uint64_t generations) {
+  for (uint64_t i = 0; i < generations; i++) {
+    if (sparse_step(sparse)) return -1;
+  }
+  return 0;
+}
+
+size_t sparse_population(sparse_t * sparse) {
+  return sparse->live.count;
+}
+
+uint64_t sparse_hash(sparse_t * sparse) {
+  return sparse->hash;
+}
+
+// Count the live cells of each color
+score_t sparse_count(sparse_t * sparse) {
+  score_t score = {0, 0, 0};
+  table_t * live = &sparse->live;
+  for (size_t i = 0; i < live->capacity; i++) {
+    if (live->values[i] & RED) score.red++;
+    if (live->values[i] & BLUE) score.blue++;
+  }
+  score.diff = score.red - score.blue;
+  return score;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "conway.h"
+
+#define SPARSE_UNBOUNDED 0 // A width or height for a playfield with no edge in that direction
+
+// A sparse engine: only the live cells are stored, in an open-addressing hash table keyed by
+// their coordinates, and a generation only visits live cells and their neighbors. Its cost
+// follows the population rather than the area, so the playfield can be unbounded, or far larger
+// than a board. Coordinates are ints, so an unbounded playfield wraps around past INT_MAX.
+typedef struct sparse sparse_t;
+
+// Create an empty engine whose playfield is width by height cells, with the same edges as a
+// board, or unbounded in either direction that is SPARSE_UNBOUNDED. Returns NULL if memory runs
+// out.
+sparse_t * sparse_create(int width, int height);
+
+void sparse_free(sparse_t * sparse);
+
+cell_t sparse_get_cell(sparse_t * sparse, int row, int column);
+
+// Set the contents of a cell, as set_cell does. Cells off the playfield are ignored. Returns
+// non-zero if memory runs out.
+int sparse_set_cell(sparse_t * sparse, int row, int column, int color, bool locked);
+
+void sparse_clear(sparse_t * sparse);
+
+// Replace the engine's cells with a board's. Returns non-zero if memory runs out.
+int sparse_load(sparse_t * sparse, board_t board);
+
+// Write the engine's cells onto a board, clearing it first. Cells that don't fit are left off.
+void sparse_store(sparse_t * sparse, board_t board);
+
+// Advance one generation, with exactly the result update_board would have. Returns non-zero if
+// memory runs out, in which case nothing changes.
+int sparse_step(sparse_t * sparse);
+
+// Advance any number of generations. Returns non-zero if memory runs out, in which case the
+// engine is left at the last generation it finished.
+int sparse_run(sparse_t * sparse, uint64_t generations);
+
+size_t sparse_population(sparse_t * sparse);
+
+// The hash of the live cells, equal to board->hash for the same cells on a board
+uint64_t sparse_hash(sparse_t * sparse);
+
+// Count the live cells of each color
+score_t sparse_count(sparse_t * sparse);
@@ -0,0 +1,254 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "socket.h"
+#include "spectate.h"
+
+// A generation as it goes out on the wire: the length header of a message, then a snapshot. One
+// frame is shared by every spectator sending it.
+typedef struct frame {
+  int refs;
+  size_t len;
+  uint8_t data[];
+} frame_t;
+
+// A spectator, and how far it has got through the frames
+typedef struct spectator {
+  int fd;
+  long next;          // The generation to send once the current one is out
+  frame_t * frame;    // The frame being sent, or NULL between frames
+  size_t sent;        // Bytes of it sent so far
+  double progress;    // When the spectator last took any bytes
+} spectator_t;
+
+struct spectators {
+  int listener;
+  int wake;                          // An eventfd written whenever there is a new frame
+  pthread_t thread;
+
+  // The frames ring and the frame references are shared with the thread, and kept under lock
+  pthread_mutex_t lock;
+  frame_t * frames[SPECTATOR_FRAMES]; // Generation n is in frames[n % SPECTATOR_FRAMES]
+  long latest;                       // The newest generation, or -1 before the first
+  bool closing;
+
+  int watching;                      // Spectators connected, read without the lock
+  bool stale;                        // Whether boards went unpublished since the newest frame
+
+  // Only the thread touches these
+  spectator_t * list;
+  int count;
+};
+
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Drop a reference to a frame, freeing it with the last. Called with the lock held.
+static void release(frame_t * frame) {
+  if (frame != NULL && --frame->refs == 0) free(frame);
+}
+
+static void drop(spectators_t * s, int i) {
+  close(s->list[i].fd);
+  pthread_mutex_lock(&s->lock);
+  release(s->list[i].frame);
+  pthread_mutex_unlock(&s->lock);
+  s->list[i] = s->list[--s->count];
+  __atomic_store_n(&s->watching, s->count, __ATOMIC_RELAXED);
+}
+
+// Send a spectator as much as its socket will take. Returns false if it should be dropped.
+static bool pump(spectators_t * s, spectator_t * spectator) {
+  while (true) {
+    if (spectator->frame == NULL) {
+      // Pick up the next frame, skipping ahead if it has already left the ring
+      pthread_mutex_lock(&s->lock);
+      if (spectator->next <= s->latest) {
+        if (spectator->next <= s->latest - SPECTATOR_FRAMES) spectator->next = s->latest;
+        spectator->frame = s->frames[spectator->next % SPECTATOR_FRAMES];
+        spectator->frame->refs++;
+        spectator->next++;
+        spectator->sent = 0;
+      }
+      pthread_mutex_unlock(&s->lock);
+      if (spectator->frame == NULL) return true;
+    }
+
+    frame_t * frame = spectator->frame;
+    ssize_t rc = send(spectator->fd, frame->data + spectator->sent, frame->len - spectator->sent,
+                      MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (rc < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    spectator->sent += rc;
+    spectator->progress = now();
+    if (spectator->sent < frame->len) continue;
+
+    pthread_mutex_lock(&s->lock);
+    release(frame);
+    pthread_mutex_unlock(&s->lock);
+    spectator->frame = NULL;
+  }
+}
+
+// Accept spectators and keep them fed until the spectators are closed
+static void * serve_spectators(void * arg) {
+  spectators_t * s = (spectators_t *) arg;
+  struct pollfd * fds = (struct pollfd *) malloc(sizeof(struct pollfd) * (MAX_SPECTATORS + 2));
+  if (fds == NULL) return NULL;
+
+  double deadline = 0;
+  while (true) {
+    pthread_mutex_lock(&s->lock);
+    bool closing = s->closing;
+    long latest = s->latest;
+    pthread_mutex_unlock(&s->lock);
+
+    // When closing, give the spectators a second to see the last of the match
+    if (closing) {
+      if (deadline == 0) deadline = now() + 1;
+      bool behind = false;
+      for (int i = 0; i < s->count; i++) {
+        if (s->list[i].frame != NULL || s->list[i].next <= latest) behind = true;
+      }
+      if (!behind || now() > deadline) break;
+    }
+
+    // Only spectators partway through a frame need to hear when their socket has room
+    fds[0] = (struct pollfd){.fd = s->wake, .events = POLLIN};
+    fds[1] = (struct pollfd){.fd = s->listener, .events = POLLIN};
+    for (int i = 0; i < s->count; i++) {
+      fds[i + 2] = (struct pollfd){.fd = s->list[i].fd,
+                                   .events = POLLIN | (s->list[i].frame ? POLLOUT : 0)};
+    }
+    int n = s->count + 2;
+    if (poll(fds, n, closing ? 50 : 1000) < 0 && errno != EINTR) break;
+
+    if (fds[0].revents & POLLIN) {
+      uint64_t frames;
+      if (read(s->wake, &frames, sizeof(frames)) < 0) {}
+    }
+
+    // Go through the spectators before accepting any, since fds lines up with the list until then
+    double time = now();
+    for (int i = n - 3; i >= 0; i--) {
+      spectator_t * spectator = &s->list[i];
+      bool alive = true;
+      if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+        // Spectators have nothing to say, so anything readable is them leaving or noise
+        char junk[256];
+        ssize_t rc = recv(spectator->fd, junk, sizeof(junk), MSG_DONTWAIT);
+        alive = rc > 0 || (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+      }
+      if (alive) alive = pump(s, spectator);
+      if (alive && spectator->frame != NULL && time - spectator->progress > SPECTATOR_TIMEOUT) {
+        alive = false;
+      }
+      if (!alive) drop(s, i);
+    }
+
+    if (fds[1].revents & POLLIN) {
+      int fd = accept(s->listener, NULL, NULL);
+      if (fd >= 0 && (s->count == MAX_SPECTATORS || fcntl(fd, F_SETFL, O_NONBLOCK))) {
+        close(fd);
+      } else if (fd >= 0) {
+        // A new spectator starts from the board as it is now, unless the newest frame is old
+        pthread_mutex_lock(&s->lock);
+        long next = s->latest < 0 ? 0 : s->latest;
+        if (__atomic_load_n(&s->stale, __ATOMIC_RELAXED)) next = s->latest + 1;
+        pthread_mutex_unlock(&s->lock);
+        s->list[s->count] = (spectator_t){.fd = fd, .next = next, .progress = time};
+        if (!pump(s, &s->list[s->count++])) {
+          drop(s, s->count - 1);
+        }
+        __atomic_store_n(&s->watching, s->count, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  free(fds);
+  return NULL;
+}
+
+// Start listening for spectators
+spectators_t * spectators_open(unsigned short * port) {
+  spectators_t * s = (spectators_t *) calloc(1, sizeof(spectators_t));
+  if (s == NULL) return NULL;
+  s->list = (spectator_t *) malloc(sizeof(spectator_t) * MAX_SPECTATORS);
+  s->latest = -1;
+  s->listener = server_socket_open(port);
+  s->wake = eventfd(0, EFD_NONBLOCK);
+  pthread_mutex_init(&s->lock, NULL);
+
+  if (s->list == NULL || s->listener == -1 || s->wake == -1 || listen(s->listener, 64) ||
+      pthread_create(&s->thread, NULL, serve_spectators, s)) {
+    if (s->listener != -1) close(s->listener);
+    if (s->wake != -1) close(s->wake);
+    pthread_mutex_destroy(&s->lock);
+    free(s->list);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+// Send the board to every spectator
+void spectators_publish(spectators_t * s, board_t board) {
+  if (s == NULL) return;
+  if (__atomic_load_n(&s->watching, __ATOMIC_RELAXED) == 0) {
+    __atomic_store_n(&s->stale, true, __ATOMIC_RELAXED);
+    return;
+  }
+
+  // Encode the generation once, with the message header every spectator will need
+  size_t len;
+  uint8_t * snapshot = encode_board(board, &len);
+  if (snapshot == NULL) return;
+  frame_t * frame = (frame_t *) malloc(sizeof(frame_t) + sizeof(size_t) + len);
+  if (frame == NULL) {
+    free(snapshot);
+    return;
+  }
+  frame->refs = 1;
+  frame->len = sizeof(size_t) + len;
+  memcpy(frame->data, &len, sizeof(size_t));
+  memcpy(frame->data + sizeof(size_t), snapshot, len);
+  free(snapshot);
+
+  pthread_mutex_lock(&s->lock);
+  s->latest++;
+  release(s->frames[s->latest % SPECTATOR_FRAMES]);
+  s->frames[s->latest % SPECTATOR_FRAMES] = frame;
+  __atomic_store_n(&s->stale, false, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&s->lock);
+
+  uint64_t one = 1;
+  if (write(s->wake, &one, sizeof(one)) < 0) {}
+}
+
+// Disconnect every spectator and stop listening
+void spectators_close(spectators_t * s) {
+  if (s == NULL) return;
+
+  pthread_mutex_lock(&s->lock);
+  s->closing = true;
+  pthread_mutex_unlock(&s->lock);
+  uint64_t one = 1;
+  if (write(s->wake, &one, sizeof(one)) < 0) {}
+  pthread_join(s->thread, NULL);
+
+  while (s->count > 0) drop(s, s->count - 1);
+  for (int i = 0; i < SPECTATOR_FRAMES; i++) release(s->frames[i]);
+  close(s->listener);
+  close(s->wake);
+  pthread_mutex_destroy(&s->lock);
+  free(s->list);
+  free(s);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "conway.h"
+
+#define SPECTATOR_FRAMES 32  // Recent generations kept for spectators that are a little behind
+#define MAX_SPECTATORS 1024  // Most spectators watching at once
+#define SPECTATOR_TIMEOUT 10 // Seconds a spectator may take no bytes at all before it is dropped
+
+// Spectators watching a match. They connect on a port of their own and are sent a snapshot of
+// the board for each generation; they never send anything back. Each generation is encoded once
+// and the same bytes go to every spectator, from a thread of their own, so the match never waits
+// on them. A spectator that falls more than SPECTATOR_FRAMES generations behind skips ahead to the
+// newest one, and one that takes nothing for SPECTATOR_TIMEOUT seconds is dropped.
+typedef struct spectators spectators_t;
+
+// Start listening for spectators on *port, or on a port the system picks if it is zero, writing
+// the port used back to *port. Returns NULL if the socket or thread can't be set up.
+spectators_t * spectators_open(unsigned short * port);
+
+// Send the board as it is now to every spectator. Costs nothing if no one is watching.
+void spectators_publish(spectators_t * spectators, board_t board);
+
+// Disconnect every spectator and stop listening. Does nothing if spectators is NULL.
+void spectators_close(spectators_t * spectators);
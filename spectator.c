@@ -0,0 +1,110 @@
+#include <ncurses.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include "conway.h"
+#include "socket.h"
+#include "ui.h"
+
+/*
+ * Spectator Program
+ *
+ * Watches a match from the server's spectator port. The server sends a snapshot of the board for
+ * each generation; when several arrive at once, only the newest is drawn.
+ */
+
+int main(int argc, char ** argv) {
+  // Check for proper arguments
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <server name> <spectator port>\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Connect to the server
+  int socket = socket_connect(argv[1], atoi(argv[2]));
+  if (socket == -1) {
+    perror("Failed to connect");
+    exit(EXIT_FAILURE);
+  }
+
+  // We only ever read, as much as is there, so the connection doesn't block
+  conn_options_t options = CONN_DEFAULTS;
+  options.nonblocking = true;
+  conn_t * server = conn_open(socket, &options);
+  if (server == NULL) exit(EXIT_FAILURE);
+
+  // Set up ncurses. Keys are only checked for between frames.
+  initscr();
+  noecho();
+  cbreak();
+  curs_set(0);
+  start_color();
+  timeout(0);
+  refresh();
+  mvprintw(0, 0, "Waiting for the match to start. Hit q to stop watching.");
+  refresh();
+
+  // The windows are set up once the first board says how big it is
+  WINDOW * w_board = NULL;
+  WINDOW * w_status = NULL;
+  board_t board = NULL;
+  bool watching = true;
+  bool malformed = false;
+
+  while (watching) {
+    // Wait for frames, or a key
+    struct pollfd fds[2] = {{.fd = socket, .events = POLLIN}, {.fd = 0, .events = POLLIN}};
+    if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+    if (getch() == 'q') break;
+    if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+    watching = conn_fill(server) == 0;
+
+    // Decode everything that arrived, keeping only the newest board
+    board_t newest = NULL;
+    char * frame;
+    size_t len;
+    while ((frame = conn_next(server, &len, MAX_BYTES_LENGTH)) != NULL) {
+      board_t next = decode_board((uint8_t *) frame, len);
+      if (next == NULL) {
+        malformed = true;
+        break;
+      }
+      if (newest != NULL) release_board(newest);
+      newest = next;
+    }
+    if (malformed || server->failed) watching = false;
+    if (newest == NULL) continue;
+
+    if (board == NULL) {
+      // Only as much of the board as fits in the terminal is shown
+      int view_width = newest->width < COLS - 2 ? newest->width : COLS - 2;
+      int view_height = newest->height < LINES - 3 ? newest->height : LINES - 3;
+      w_board = newwin(view_height,view_width,2,1);
+      w_status = newwin(1,COLS,0,0);
+      erase();
+      for (int x=0;x<=view_width+1;x++) {
+        for (int y=1;y<=view_height+2;y++) {
+          if ((x==0 || x==view_width+1) || (y==1 || y==view_height+2)) {
+            mvaddch(y,x,'*');
+          }
+        }
+      }
+      refresh();
+    } else {
+      release_board(board);
+    }
+    board = newest;
+    print_board(board,w_board,w_status);
+  }
+
+  endwin();
+  release_board(board);
+  drain_board_pool();
+  conn_close(server);
+  if (malformed) {
+    printf("The server sent something that isn't a board.\n");
+    return -1;
+  }
+  printf("Done watching.\n");
+  return 0;
+}
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+static const char * phase_names[PHASES] = {
+  "place", "exchange", "update", "render", "round_trip", "wait"
+};
+
+// Times of one phase, in nanoseconds. Bucket i counts the times under 2^i nanoseconds that
+// aren't under 2^(i-1). Any thread may add to them, so they are only touched atomically.
+typedef struct phase_stats {
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t buckets[STATS_BUCKETS];
+} phase_stats_t;
+
+// A connection being reported, and its numbers as of when it closed
+typedef struct connection_stats {
+  conn_t * conn; // NULL once closed
+  const char * name;
+  size_t messages_sent, bytes_sent, writes;
+  size_t messages_received, bytes_received, reads;
+} connection_stats_t;
+
+static struct {
+  bool on;
+  const char * path;
+  double opened;
+  phase_stats_t phases[PHASES];
+
+  pthread_mutex_t lock; // Held while writing, and while the connections change
+  connection_stats_t connections[STATS_CONNECTIONS];
+  int nconnections;
+
+  int signals[2]; // SIGUSR1 writes a byte to the first, for the writer thread to read
+} stats = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Only async-signal-safe calls are allowed here, so the writing is left to a thread
+static void on_signal(int signum) {
+  (void)signum;
+  char byte = 1;
+  int saved = errno;
+  if (write(stats.signals[1], &byte, 1) < 0) {}
+  errno = saved;
+}
+
+static void * signal_writer(void * arg) {
+  (void)arg;
+  char byte;
+  while (read(stats.signals[0], &byte, 1) > 0 || errno == EINTR) {
+    stats_write();
+  }
+  return NULL;
+}
+
+static void write_at_exit() {
+  stats_write();
+}
+
+// Start collecting stats
+int stats_open(const char * path) {
+  stats.path = path;
+  stats.opened = now();
+  if (pipe(stats.signals)) return -1;
+
+  pthread_t writer;
+  if (pthread_create(&writer, NULL, signal_writer, NULL)) return -1;
+  pthread_detach(writer);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGUSR1, &action, NULL)) return -1;
+
+  atexit(write_at_exit);
+  __atomic_store_n(&stats.on, true, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// When a phase starts
+double stats_begin() {
+  return __atomic_load_n(&stats.on, __ATOMIC_RELAXED) ? now() : 0;
+}
+
+// Add the time a phase took to its totals and histogram
+void stats_end(int phase, double begin) {
+  if (begin == 0) return;
+  double seconds = now() - begin;
+  uint64_t ns = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;
+  int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+  if (bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+
+  phase_stats_t * p = &stats.phases[phase];
+  __atomic_fetch_add(&p->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&p->total, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&p->buckets[bucket], 1, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&p->max, __ATOMIC_RELAXED);
+  while (ns > max &&
+         !__atomic_compare_exchange_n(&p->max, &max, ns, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {}
+}
+
+// Report a connection's traffic
+void stats_connection(conn_t * conn, const char * name) {
+  pthread_mutex_lock(&stats.lock);
+  if (stats.nconnections < STATS_CONNECTIONS) {
+    connection_stats_t * c = &stats.connections[stats.nconnections++];
+    memset(c, 0, sizeof(connection_stats_t));
+    c->conn = conn;
+    c->name = name;
+  }
+  pthread_mutex_unlock(&stats.lock);
+}
+
+// Copy a connection's numbers in from it
+static void take_counters(connection_stats_t * c) {
+  c->messages_sent = c->conn->messages_sent;
+  c->bytes_sent = c->conn->bytes_sent;
+  c->writes = c->conn->writes;
+  c->messages_received = c->conn->messages_received;
+  c->bytes_received = c->conn->bytes_received;
+  c->reads = c->conn->reads;
+}
+
+// Keep a connection's final numbers before it is freed
+void stats_connection_closed(conn_t * conn) {
+  pthread_mutex_lock(&stats.lock);
+  for (int i = 0; i < stats.nconnections; i++) {
+    if (stats.connections[i].conn == conn) {
+      take_counters(&stats.connections[i]);
+      stats.connections[i].conn = NULL;
+    }
+  }
+  pthread_mutex_unlock(&stats.lock);
+}
+
+// The time under which a fraction of a phase's times fall, in microseconds, going by the
+// histogram, so it is only good to a factor of two
+static double quantile(uint64_t buckets[STATS_BUCKETS], uint64_t count, double fraction) {
+  uint64_t seen = 0;
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen > 0 && seen >= fraction * count) return (double)((uint64_t)1 << i) / 1000;
+  }
+  return 0;
+}
+
+// Write every phase, connection and histogram out as CSV, one section after another
+void stats_write() {
+  if (!__atomic_load_n(&stats.on, __ATOMIC_ACQUIRE)) return;
+  pthread_mutex_lock(&stats.lock);
+  FILE * file = fopen(stats.path, "w");
+  if (file == NULL) {
+    pthread_mutex_unlock(&stats.lock);
+    return;
+  }
+
+  fprintf(file, "# %.3f seconds of stats\n", now() - stats.opened);
+  fprintf(file, "phase,count,total_seconds,mean_us,max_us,p50_us,p90_us,p99_us\n");
+  phase_stats_t phases[PHASES];
+  for (int i = 0; i < PHASES; i++) {
+    phase_stats_t * p = &phases[i];
+    p->count = __atomic_load_n(&stats.phases[i].count, __ATOMIC_RELAXED);
+    p->total = __atomic_load_n(&stats.phases[i].total, __ATOMIC_RELAXED);
+    p->max = __atomic_load_n(&stats.phases[i].max, __ATOMIC_RELAXED);
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+      p->buckets[b] = __atomic_load_n(&stats.phases[i].buckets[b], __ATOMIC_RELAXED);
+    }
+    fprintf(file, "%s,%llu,%.6f,%.1f,%.1f,%.1f,%.1f,%.1f\n", phase_names[i],
+            (unsigned long long)p->count, p->total / 1e9,
+            p->count ? p->total / 1e3 / p->count : 0, p->max / 1e3,
+            quantile(p->buckets, p->count, 0.5), quantile(p->buckets, p->count, 0.9),
+            quantile(p->buckets, p->count, 0.99));
+  }
+
+  fprintf(file, "\nconnection,messages_sent,bytes_sent,writes,messages_received,"
+          "bytes_received,reads\n");
+  for (int i = 0; i < stats.nconnections; i++) {
+    connection_stats_t * c = &stats.connections[i];
+    if (c->conn != NULL) take_counters(c);
+    fprintf(file, "%s,%zu,%zu,%zu,%zu,%zu,%zu\n", c->name, c->messages_sent, c->bytes_sent,
+            c->writes, c->messages_received, c->bytes_received, c->reads);
+  }
+
+  // Only the buckets anything fell in
+  fprintf(file, "\nphase,under_us,count\n");
+  for (int i = 0; i < PHASES; i++) {
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+      if (phases[i].buckets[b] == 0) continue;
+      fprintf(file, "%s,%g,%llu\n", phase_names[i], (double)((uint64_t)1 << b) / 1000,
+              (unsigned long long)phases[i].buckets[b]);
+    }
+  }
+
+  fclose(file);
+  pthread_mutex_unlock(&stats.lock);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "message.h"
+
+// The phases of a match that are timed
+enum Phase {
+  PHASE_PLACE,      // A player placing cells, or the bot choosing them
+  PHASE_EXCHANGE,   // Swapping placements, hashes and boards with the other side
+  PHASE_UPDATE,     // Working out a generation
+  PHASE_RENDER,     // Drawing the board
+  PHASE_ROUND_TRIP, // The server sending "update" until the client's hash comes back
+  PHASE_WAIT,       // Waiting on the other side for anything else
+  PHASES
+};
+
+#define STATS_BUCKETS 40   // Each phase's times are kept in a histogram of this many buckets
+#define STATS_CONNECTIONS 8 // Most connections whose traffic is reported
+
+// Start collecting stats. They are written to path when the program exits, and whenever it gets
+// SIGUSR1, replacing what was there. Returns non-zero if that can't be set up.
+int stats_open(const char * path);
+
+// Time a phase: stats_begin gives the time it started, to hand to stats_end once it is over. Both
+// cost next to nothing while stats are off.
+double stats_begin();
+
+void stats_end(int phase, double begin);
+
+// Report a connection's messages and bytes along with the phases, under a name. conn_close lets
+// the stats know when it goes, so its final numbers are kept.
+void stats_connection(conn_t * conn, const char * name);
+
+void stats_connection_closed(conn_t * conn);
+
+// Write the stats out now
+void stats_write();
@@ -0,0 +1,387 @@
+#include "transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Times a side checks an empty or full ring before going to sleep on it. The other side is
+// usually running on another core, and about to get to it.
+#define RING_SPINS 2000
+
+// Milliseconds between looks at a ring while also waiting on an input descriptor, which can't
+// wake a futex
+#define RING_POLL_SLICE 10
+
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sockets
+
+static ssize_t socket_send(conn_t* conn, const struct iovec* iov, int count) {
+  // A peer that hangs up is an error to return, not a SIGPIPE to die of
+  struct msghdr msg = {.msg_iov = (struct iovec*)iov, .msg_iovlen = count};
+  return sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+}
+
+static ssize_t socket_receive(conn_t* conn, void* buffer, size_t len) {
+  return read(conn->fd, buffer, len);
+}
+
+static int socket_wait(conn_t* conn, int input, int ms, bool* readable, bool* input_readable) {
+  struct pollfd fds[2] = {{.fd = conn->fd, .events = POLLIN}, {.fd = input, .events = POLLIN}};
+  if (poll(fds, 2, ms) < 0) return -1;
+  *readable = fds[0].revents & (POLLIN | POLLHUP | POLLERR);
+  *input_readable = fds[1].revents & (POLLIN | POLLHUP | POLLERR);
+  return 0;
+}
+
+static void socket_close(conn_t* conn) {
+  close(conn->fd);
+}
+
+const transport_t socket_transport = {
+  .name = "socket",
+  .send = socket_send,
+  .receive = socket_receive,
+  .wait = socket_wait,
+  .close = socket_close
+};
+
+// Shared memory
+
+// One direction of a shared connection. Positions count every byte that has ever gone through,
+// and each side only writes its own half, on a cache line of its own.
+typedef struct ring {
+  // Written by the sender
+  _Alignas(64) uint64_t head;  // Bytes written
+  uint32_t produced;           // Bumped after every write, for a sleeping receiver to wait on
+  uint32_t sender_asleep;      // The sender is waiting for room
+  uint32_t closed;             // The sender has closed its end
+
+  // Written by the receiver
+  _Alignas(64) uint64_t tail;  // Bytes read
+  uint32_t consumed;           // Bumped after every read, for a sleeping sender to wait on
+  uint32_t receiver_asleep;    // The receiver is waiting for bytes
+
+  _Alignas(64) uint8_t bytes[RING_SIZE];
+} ring_t;
+
+// The memory both processes map. The side that created it sends on the first ring.
+typedef struct shared {
+  ring_t rings[2];
+} shared_t;
+
+// Our end of a shared connection
+typedef struct link {
+  shared_t* shared;
+  ring_t* out;
+  ring_t* in;
+  int spins;     // RING_SPINS, or none with only one core to spin on
+  bool hung_up;  // The other process went away without closing
+} link_t;
+
+static void futex_wait(uint32_t* word, uint32_t seen, double seconds) {
+  struct timespec ts = {.tv_sec = (time_t)seconds,
+                        .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9)};
+  syscall(SYS_futex, word, FUTEX_WAIT, seen, &ts, NULL, 0);
+}
+
+static void futex_wake(uint32_t* word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Move a position forward and wake the other side if it went to sleep waiting for that. The
+// store and the look at its flag are both sequentially consistent, so either we see the flag, or
+// it sees the new position before it sleeps.
+static void ring_advance(uint64_t* position, uint64_t value, uint32_t* counter, uint32_t* asleep) {
+  __atomic_store_n(position, value, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(counter, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(asleep, __ATOMIC_SEQ_CST)) futex_wake(counter);
+}
+
+// Sleep for up to some seconds while a position the other side moves stays where it is
+static void ring_sleep(const uint64_t* position, uint64_t unchanged, uint32_t* counter,
+                       uint32_t* asleep, double seconds) {
+  uint32_t seen = __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+  __atomic_store_n(asleep, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(position, __ATOMIC_SEQ_CST) == unchanged) futex_wait(counter, seen, seconds);
+  __atomic_store_n(asleep, 0, __ATOMIC_SEQ_CST);
+}
+
+// Whether the process at the other end of the socket has gone. Nothing is sent on the socket once
+// the rings are set up, so it only becomes readable when the other side closes.
+static bool peer_gone(int fd) {
+  char byte;
+  return recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+static bool shared_closed(link_t* link) {
+  return link->hung_up || __atomic_load_n(&link->in->closed, __ATOMIC_ACQUIRE);
+}
+
+static ssize_t shared_send(conn_t* conn, const struct iovec* iov, int count) {
+  link_t* link = conn->link;
+  ring_t* ring = link->out;
+  int spins = 0;
+  while (true) {
+    if (shared_closed(link)) {
+      errno = EPIPE;
+      return -1;
+    }
+
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t room = RING_SIZE - (head - tail);
+    if (room > 0) {
+      // Copy in as much of the frames as fits, wrapping around the end of the ring
+      size_t sent = 0;
+      for (int i = 0; i < count && sent < room; i++) {
+        size_t len = iov[i].iov_len < room - sent ? iov[i].iov_len : room - sent;
+        if (len == 0) continue;
+        size_t offset = (head + sent) & (RING_SIZE - 1);
+        size_t first = RING_SIZE - offset < len ? RING_SIZE - offset : len;
+        memcpy(ring->bytes + offset, iov[i].iov_base, first);
+        memcpy(ring->bytes, (uint8_t*)iov[i].iov_base + first, len - first);
+        sent += len;
+      }
+      ring_advance(&ring->head, head + sent, &ring->produced, &ring->receiver_asleep);
+      return sent;
+    }
+
+    if (conn->nonblocking) {
+      errno = EAGAIN;
+      return -1;
+    }
+    if (spins++ < link->spins) continue;
+
+    // Wait for the receiver to make room, making sure every so often that it is still there
+    ring_sleep(&ring->tail, tail, &ring->consumed, &ring->sender_asleep, RING_LIVENESS);
+    if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == tail && peer_gone(conn->fd)) {
+      link->hung_up = true;
+    }
+  }
+}
+
+static ssize_t shared_receive(conn_t* conn, void* buffer, size_t len) {
+  link_t* link = conn->link;
+  ring_t* ring = link->in;
+  double start = 0;
+  int spins = 0;
+  while (true) {
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      size_t got = head - tail < len ? head - tail : len;
+      size_t offset = tail & (RING_SIZE - 1);
+      size_t first = RING_SIZE - offset < got ? RING_SIZE - offset : got;
+      memcpy(buffer, ring->bytes + offset, first);
+      memcpy((uint8_t*)buffer + first, ring->bytes, got - first);
+      ring_advance(&ring->tail, tail + got, &ring->consumed, &ring->sender_asleep);
+      return got;
+    }
+
+    // Whatever the other side wrote before closing has been read
+    if (shared_closed(link)) return 0;
+
+    if (conn->nonblocking) {
+      errno = EAGAIN;
+      return -1;
+    }
+    if (spins++ < link->spins) continue;
+
+    // Sleep until bytes arrive, giving up after the wake interval as a socket would
+    double time = now();
+    if (start == 0) start = time;
+    double seconds = RING_LIVENESS;
+    if (conn->wake > 0) {
+      if (time - start >= conn->wake) {
+        errno = EAGAIN;
+        return -1;
+      }
+      if (conn->wake - (time - start) < seconds) seconds = conn->wake - (time - start);
+    }
+    ring_sleep(&ring->head, tail, &ring->produced, &ring->receiver_asleep, seconds);
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail && peer_gone(conn->fd)) {
+      link->hung_up = true;
+    }
+  }
+}
+
+static int shared_wait(conn_t* conn, int input, int ms, bool* readable, bool* input_readable) {
+  link_t* link = conn->link;
+  ring_t* ring = link->in;
+  double end = now() + ms / 1000.0;
+  *readable = false;
+  *input_readable = false;
+
+  // A terminal can't wake a futex, so poll it and the socket in short slices, looking at the ring
+  // in between
+  while (true) {
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail || shared_closed(link)) {
+      *readable = true;
+    }
+
+    int slice = *readable ? 0 : RING_POLL_SLICE;
+    if (ms >= 0) {
+      int left = (int)((end - now()) * 1000);
+      if (left < slice) slice = left > 0 ? left : 0;
+    }
+    struct pollfd fds[2] = {{.fd = conn->fd, .events = POLLIN}, {.fd = input, .events = POLLIN}};
+    if (poll(fds, 2, slice) < 0) return -1;
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      link->hung_up = true;
+      *readable = true;
+    }
+    *input_readable = fds[1].revents & (POLLIN | POLLHUP | POLLERR);
+    if (*readable || *input_readable || slice == 0) return 0;
+  }
+}
+
+static void shared_close(conn_t* conn) {
+  link_t* link = conn->link;
+
+  // Wake the other side wherever it is waiting on us, so it sees we are gone
+  __atomic_store_n(&link->out->closed, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&link->out->produced, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&link->out->produced);
+  __atomic_add_fetch(&link->in->consumed, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&link->in->consumed);
+
+  transport_release(link);
+  close(conn->fd);
+}
+
+const transport_t shared_transport = {
+  .name = "shared memory",
+  .send = shared_send,
+  .receive = shared_receive,
+  .wait = shared_wait,
+  .close = shared_close
+};
+
+// Map the shared memory behind a descriptor, with our end of it
+static link_t* shared_map(int memory, bool creator) {
+  link_t* link = calloc(1, sizeof(link_t));
+  if (link == NULL) return NULL;
+  link->shared = mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+  if (link->shared == MAP_FAILED) {
+    free(link);
+    return NULL;
+  }
+  link->out = &link->shared->rings[creator ? 0 : 1];
+  link->in = &link->shared->rings[creator ? 1 : 0];
+  link->spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPINS : 0;
+  return link;
+}
+
+void transport_release(void* link) {
+  if (link == NULL) return;
+  munmap(((link_t*)link)->shared, sizeof(shared_t));
+  free(link);
+}
+
+// The first byte on a local socket says which transport follows. The descriptor of the shared
+// memory comes along with it.
+#define OFFER_SOCKET 's'
+#define OFFER_SHARED 'm'
+
+int transport_offer(int fd, bool shared, void** link) {
+  *link = NULL;
+  char offer = shared ? OFFER_SHARED : OFFER_SOCKET;
+  struct iovec iov = {.iov_base = &offer, .iov_len = 1};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  union {
+    struct cmsghdr header;
+    char space[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  int memory = -1;
+  if (shared) {
+    // Create the memory under a name nobody else will pick, and unlink it right away. Only the
+    // descriptor passed over the socket keeps it around.
+    static int created = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "/conway-%d-%d", (int)getpid(), created++);
+    memory = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (memory == -1) return -1;
+    shm_unlink(name);
+    if (ftruncate(memory, sizeof(shared_t)) || (*link = shared_map(memory, true)) == NULL) {
+      close(memory);
+      return -1;
+    }
+
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memory, sizeof(int));
+  }
+
+  ssize_t rc;
+  while ((rc = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+
+  // The other side has its own descriptor now, and the mapping keeps the memory for us
+  if (memory != -1) close(memory);
+  if (rc != 1) {
+    transport_release(*link);
+    *link = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int transport_accept(int fd, void** link) {
+  *link = NULL;
+  char offer;
+  struct iovec iov = {.iov_base = &offer, .iov_len = 1};
+  union {
+    struct cmsghdr header;
+    char space[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.space,
+                       .msg_controllen = sizeof(control.space)};
+
+  ssize_t rc;
+  while ((rc = recvmsg(fd, &msg, 0)) < 0 && errno == EINTR) {}
+  if (rc == 0) errno = ECONNRESET;
+  if (rc != 1) return -1;
+
+  int memory = -1;
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+    memcpy(&memory, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  if (offer == OFFER_SOCKET && memory == -1) return 0;
+
+  // Anything else has to be shared memory laid out just like ours
+  struct stat st;
+  if (offer != OFFER_SHARED || memory == -1 || fstat(memory, &st) ||
+      st.st_size != sizeof(shared_t)) {
+    if (memory != -1) close(memory);
+    errno = EPROTO;
+    return -1;
+  }
+  *link = shared_map(memory, false);
+  close(memory);
+  return *link == NULL ? -1 : 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "message.h"
+
+// What a buffered connection moves its bytes over. Sockets, TCP or Unix-domain, are the default.
+// Two processes on the same host can share a pair of ring buffers instead, so messages never go
+// through the kernel's socket buffers at all.
+typedef struct transport {
+  const char* name;
+
+  // Write as much of iov as will go, returning how many bytes went, or -1 with errno set. On a
+  // non-blocking connection EAGAIN means nothing would go without waiting.
+  ssize_t (*send)(conn_t* conn, const struct iovec* iov, int count);
+
+  // Read up to len bytes, returning how many, zero once the other side has closed, or -1 with
+  // errno set. A blocking read gives up with EAGAIN after the connection's wake interval, if it
+  // has one, so heartbeats and timeouts can be seen to.
+  ssize_t (*receive)(conn_t* conn, void* buffer, size_t len);
+
+  // Wait up to ms milliseconds, or forever if ms is negative, for the connection or an input
+  // descriptor to become readable, and say which did. Returns -1 with errno set on failure.
+  int (*wait)(conn_t* conn, int input, int ms, bool* readable, bool* input_readable);
+
+  // Let go of everything the connection's transport holds, the socket included
+  void (*close)(conn_t* conn);
+} transport_t;
+
+extern const transport_t socket_transport;
+extern const transport_t shared_transport;
+
+// Bytes each ring buffer holds. A power of two, so positions in it wrap with a mask.
+#define RING_SIZE (1 << 20)
+
+// Seconds a process waiting on a ring sleeps between checks that the other side is still there
+#define RING_LIVENESS 0.25
+
+// Tell the process at the other end of a Unix-domain socket which transport to use. With shared
+// set, a pair of rings is created and sent across, and *link is set to our end of them for
+// shared_transport. Returns a non-zero value, with errno set, if this fails.
+int transport_offer(int fd, bool shared, void** link);
+
+// Take whichever transport the other end offered, setting *link to our end of the rings, or to
+// NULL for the socket itself. Returns a non-zero value, with errno set, if this fails.
+int transport_accept(int fd, void** link);
+
+// Unmap a link that never made it into a connection
+void transport_release(void* link);
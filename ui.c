@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "ui.h"
+
+// What display_board last drew, so the next frame only has to draw the cells that changed
+static struct {
+  WINDOW * window;
+  int width;
+  int height;
+  int rows;       // The part of the board that fit in the window
+  int columns;
+  uint64_t * red;
+  uint64_t * blue;
+  double drawn;   // When the frame was drawn, in seconds
+} frame;
+
+// Seconds on a clock that only goes forward
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Render the board to an ncurses window
+score_t display_board(board_t board, WINDOW * w_board) {
+  // Color pairs only need to be set up once
+  static bool colors = false;
+  if (!colors) {
+    //init_pair(RED,COLOR_RED,COLOR_BLACK);
+    //init_pair(BLUE,COLOR_CYAN,COLOR_BLACK);
+    init_pair(RED,COLOR_BLACK,COLOR_RED);
+    init_pair(BLUE,COLOR_BLACK,COLOR_CYAN);
+    colors = true;
+  }
+
+  // The cursor goes back where it was, so a player placing cells doesn't lose their place
+  int cursor_y;
+  int cursor_x;
+  getyx(w_board,cursor_y,cursor_x);
+
+  int max_y;
+  int max_x;
+  getmaxyx(w_board,max_y,max_x);
+  int rows = board->height < max_y ? board->height : max_y;
+  int columns = board->width < max_x ? board->width : max_x;
+
+  // Start from a blank window if this isn't the board or window we drew last time
+  if (frame.window != w_board || frame.width != board->width || frame.height != board->height ||
+      frame.rows != rows || frame.columns != columns) {
+    size_t plane = (size_t)board->height * board->words;
+    free(frame.red);
+    frame.red = (uint64_t *) calloc(plane * 2, sizeof(uint64_t));
+    if (frame.red == NULL) exit(-1);
+    frame.blue = frame.red + plane;
+    frame.window = w_board;
+    frame.width = board->width;
+    frame.height = board->height;
+    frame.rows = rows;
+    frame.columns = columns;
+    werase(w_board);
+  }
+
+  // Draw only the cells that differ from the last frame, a word of them at a time
+  for (int row = 0; row < rows; row++) {
+    for (int word = 0; word * WORD_BITS < columns; word++) {
+      size_t i = (size_t)row * board->words + word;
+      uint64_t changed = (board->red[i] ^ frame.red[i]) | (board->blue[i] ^ frame.blue[i]);
+      if (columns - word * WORD_BITS < WORD_BITS) {
+        changed &= ((uint64_t)1 << (columns - word * WORD_BITS)) - 1;
+      }
+
+      while (changed) {
+        int bit = __builtin_ctzll(changed);
+        changed &= changed - 1;
+        uint64_t mask = (uint64_t)1 << bit;
+        int col = word * WORD_BITS + bit;
+        if (board->red[i] & mask) {
+          wattrset(w_board,COLOR_PAIR(RED));
+          mvwaddch(w_board,row,col,'#');
+        } else if (board->blue[i] & mask) {
+          wattrset(w_board,COLOR_PAIR(BLUE));
+          mvwaddch(w_board,row,col,'@');
+        } else {
+          wattrset(w_board,A_NORMAL);
+          mvwaddch(w_board,row,col,' ');
+        }
+      }
+
+      frame.red[i] = board->red[i];
+      frame.blue[i] = board->blue[i];
+    }
+  }
+  wattrset(w_board,A_NORMAL);
+  wmove(w_board,cursor_y,cursor_x);
+  frame.drawn = now();
+
+  return count_board(board);
+}
+
+// Print out both the board and the status line
+score_t print_board(board_t board, WINDOW * w_board, WINDOW * w_status) {
+  double begin = stats_begin();
+  score_t score = display_board(board, w_board);
+
+  werase(w_status);
+
+  if (score.diff > 0) {
+    wprintw(w_status,"Red is up by %d.",score.diff);
+  } else if (score.diff < 0) {
+    wprintw(w_status,"Blue is up by %d.",score.diff*-1);
+  } else {
+    wprintw(w_status,"Red and Blue are tied!");
+  }
+
+  wrefresh(w_board);
+  wrefresh(w_status);
+
+  stats_end(PHASE_RENDER, begin);
+  return score;
+}
+
+// Print the board as one frame of a round that is playing out. If the last frame went out too
+// recently for the terminal to keep up, this one is skipped.
+score_t animate_board(board_t board, WINDOW * w_board, WINDOW * w_status) {
+  if (frame.window == w_board && now() - frame.drawn < 1.0 / FRAME_RATE) {
+    return count_board(board);
+  }
+  return print_board(board, w_board, w_status);
+}
+
+// Wait for a key, keeping the connection alive and reading it while we do
+int wait_key(conn_t * conn) {
+  if (conn == NULL) return getch();
+
+  // Keys ncurses has already read in won't wake poll, so take those first
+  nodelay(stdscr, true);
+  int c;
+  while ((c = getch()) == ERR) {
+    if (conn_wait(conn, STDIN_FILENO)) break;
+  }
+  nodelay(stdscr, false);
+  return c;
+}
+
+// Allow the user to select a spot to place a cell
+int place_cell(int color, board_t board, placements_t * placements, WINDOW * w_board,
+               WINDOW * w_status, conn_t * conn) {
+  wrefresh(w_board);
+  int y;
+  int x;
+  getyx(w_board,y,x);
+  cell_t target;
+  int c;
+  bool placing = true;
+  while ((c=wait_key(conn)) != ERR && placing) {
+    switch (c) {
+    case KEY_LEFT:
+    case 'h':
+      x--;
+      break;
+    case KEY_RIGHT:
+    case 'l':
+      x++;
+      break;
+    case KEY_UP:
+    case 'k':
+      y--;
+      break;
+    case KEY_DOWN:
+    case 'j':
+      y++;
+      break;
+    case 'b':
+      x--;
+      y++;
+      break;
+    case 'n':
+      x++;
+      y++;
+      break;
+    case 'y':
+      x--;
+      y--;
+      break;
+    case 'u':
+      x++;
+      y--;
+      break;
+    case 'z':
+    case '\n':
+    case '.':
+    case KEY_ENTER:
+      target = get_cell(board,y,x);
+      if (target.alive && target.color == color && !target.locked) {
+        set_cell(board,y,x,COLORLESS,false);
+        record_placement(placements,y,x,COLORLESS);
+
+        display_board(board,w_board);
+        wmove(w_board,y,x);
+        wrefresh(w_board);
+
+        return -1;
+      } else if (!target.alive) {
+        set_cell(board,y,x,color,false);
+        record_placement(placements,y,x,color);
+
+        display_board(board,w_board);
+        wmove(w_board,y,x);
+        wrefresh(w_board);
+
+        return 1;
+      } else {
+        break;
+      }
+    case 'q':
+      return 0;
+    }
+    
+    // Stay on the part of the board that is visible
+    int max_y;
+    int max_x;
+    getmaxyx(w_board,max_y,max_x);
+    if (max_x > board->width) max_x = board->width;
+    if (max_y > board->height) max_y = board->height;
+    if (x<0) x=0;
+    if (x>=max_x) x=max_x-1;
+    if (y<0) y=0;
+    if (y>=max_y) y=max_y-1;
+
+    // Nothing on the board changed, so only the cursor needs to move
+    wmove(w_board,y,x);
+    wrefresh(w_board);
+  }
+
+  // The other side is gone, so there's no point placing any more
+  return 0;
+}
+
+// Allow the user to set the board
+void set_board(int count, int color, board_t board, placements_t * placements, WINDOW * w_board,
+               WINDOW * w_status, conn_t * conn) {
+  placements->count = 0;
+  curs_set(1);
+  for (int i = 0; i < count; i++) {
+    werase(w_status);
+    wprintw(w_status,"%d cells remaining.",count-i);
+    wrefresh(w_status);
+    int cont = place_cell(color,board,placements,w_board,w_status,conn);
+    if (cont == -1) {
+      i-=2;
+    }
+    if (!cont) break;
+  }
+  curs_set(0);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <ncurses.h>
+
+#include "conway.h"
+
+// The terminal side of the game: drawing boards into ncurses windows and letting a player place
+// cells. Everything else lives in conway.h, which needs no terminal.
+
+#define FRAME_RATE 60 // Most frames a second drawn while a round plays out
+
+// Draw the board, and the score in the status bar. Returns the score.
+score_t print_board(board_t board, WINDOW * w_board, WINDOW * w_status);
+
+// Print the board as a frame of a round in progress, skipping it if the last frame was less than
+// 1/FRAME_RATE seconds ago. Returns the score either way.
+score_t animate_board(board_t board, WINDOW * w_board, WINDOW * w_status);
+
+// Wait for a key. While we do, anything the other side sends on conn is buffered and heartbeats
+// go out, so a player taking their time doesn't look like a dead connection. Returns ERR if conn
+// closes or times out first. With a NULL conn, this is just getch.
+int wait_key(conn_t * conn);
+
+// Return whether a the player wishes to continue placing
+int place_cell(int color, board_t board, placements_t * placements, WINDOW * w_board,
+               WINDOW * w_status, conn_t * conn);
+
+// Let the player place their cells, recording what they did in placements. Placing stops early
+// if conn closes, as it does if they quit.
+void set_board(int count, int color, board_t board, placements_t * placements, WINDOW * w_board,
+               WINDOW * w_status, conn_t * conn);